@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "command_queue.h"
+
+// executes the queued commands from the loop, as many as fit in the drain budget, so a whole animation frame is applied in one pass
+// the budget is cut short by the step engine when it has to be polled earlier, at least one command is executed per call
+void executeQueuedCommands(CommandQueue &queue);
+
+// set by the master with the set_drain_budget command
+void setCommandDrainBudget(uint16_t budget_us);
+uint16_t commandDrainBudget();
+
+// counted since the last reset, to tune the budget, the master reads and resets them with a query_drain_stats query
+struct CommandDrainStats{
+    uint32_t commands; // executed commands, including invalid ones
+    uint32_t passes; // calls that executed at least one command
+    uint16_t max_per_pass;
+    uint32_t budget_exhausted; // passes that ended with commands left in the queue
+};
+
+CommandDrainStats commandDrainStats();
+void resetCommandDrainStats();
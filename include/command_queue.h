@@ -4,25 +4,36 @@
 #include "config.h"
 #include "packet_handlers.h"
 
+#if (CMD_QUEUE_LENGTH & (CMD_QUEUE_LENGTH - 1)) != 0
+  #error "CMD_QUEUE_LENGTH has to be a power of two"
+#endif
+
 struct CommandData{
     byte buffer[MAX_COMMAND_LENGTH];
     uint8_t bufferLength;
-    uint8_t commandID;
-    bool hasExecuted = true; //an object with this set to false is returned when the queue is empty
 };
 
+//single producer single consumer ring buffer, commands are pushed from the i2c interrupt and popped in loop()
+//each index is only written by one side, so no locking is needed
+//commands are received into and parsed from the slots directly, so a command is never copied
 class CommandQueue{
 public:
-    bool pushCommand(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength); //returns true if overwrote a command that hasnt been executed yet
-    //this returns a reference to the buffer of the next command to be executed and the command id
-    const CommandData& popCommand();
+    //only called from the i2c interrupt, returns the slot to receive the next command into, nullptr if the queue is full
+    //offset reserves the slots after it, so all commands of a batch can be received before any of them is committed
+    CommandData *reserveCommand(uint8_t offset = 0);
+    //only called from the i2c interrupt, makes the commands in the reserved slots visible to loop()
+    void commitCommands(uint8_t count = 1);
+    //only called from loop(), returns the next command without removing it, nullptr if the queue is empty
+    //the slot stays valid until popCommand(), so packets can be parsed and executed from it in place
+    CommandData *peekCommand();
+    //only called from loop(), frees the slot of the command returned by peekCommand()
+    void popCommand();
     bool isEmpty();
 
 private:
     //array of command data for each item in the entire queue length
     CommandData commands[CMD_QUEUE_LENGTH];
-    uint16_t current_execute_index;
-    uint16_t current_push_index;
-
-    CommandData invalid_command = {{0}, 0, 0, false};
+    //free running, the slot is the index masked by CMD_QUEUE_LENGTH - 1, so tail - head is the number of queued commands
+    volatile uint16_t head; //next command to pop, only written by popCommand
+    volatile uint16_t tail; //next slot to receive into, only written by commitCommands
 };
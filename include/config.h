@@ -12,6 +12,7 @@
 #define NUM_STEPPERS_M 4
 #define STEPPER_DEFAULT_SPEED 700
 #define STEPPER_DEFAULT_ACCEL 300
+#define STEPPER_DEFAULT_JERK 1500 // only used by the s-curve profile
 #define STEPS_PER_REVOLUTION 4320 //360*12
 #define STEPPER_DEFAULT_POS_FRACTION 0.5 //at 6o'clock position
 
@@ -24,9 +25,38 @@
   #define ENABLE_PIN 17
 #endif
 
+// automatic driver enable, see driver_power.h
+#define DRIVER_DEFAULT_MODE driver_auto
+#define DRIVER_IDLE_HOLD_MS 2000 // drivers are disabled after all steppers were idle this long
+
 #define MAX_SPEED 800
 #define MIN_SPEED 5
 #define MAX_ACCEL 500
 #define MIN_ACCEL 5
+#define MAX_JERK 60000
+#define MIN_JERK 50
+
+#define CMD_QUEUE_LENGTH 128 // has to be a power of two
+#define COMMAND_DRAIN_BUDGET_US 2000 // how long loop() may keep executing queued commands in one pass, a whole frame of commands is applied at once then
+#define MAX_COMMAND_DRAIN_BUDGET_US 20000 // the most the master can set, nothing else in loop() runs during a pass
+#define COMMAND_DRAIN_STATS_INTERVAL_MS 10000 // with DEBUG, how often the executed commands per pass are printed
+
+// step generation, driven by a hardware timer on the stm32 so command handling in loop() cant delay steps
+// the timer interrupts at the next step deadline instead of at a fixed rate, so it only wakes the core to step
+#define STEP_TIMER_ENABLED true
+#define STEP_TIMER TIM2
+#define STEP_TIMER_CHANNEL 1 // compare channel that interrupts at the next step deadline, no pin is used
+#define STEP_TIMER_MIN_DELAY_US 10 // shortest time the next interrupt is set ahead, upper bound for the step timing jitter
+#define STEP_TIMER_MAX_DELAY_US 50000 // longest, has to stay below the 65536us the 16 bit counter wraps around in
+
+// step pulses of all steppers that are due in the same tick are output together with one port register write
+#define STEP_OUTPUT_BATCHED true
+#define STEP_OUTPUT_MAX_PORTS 4 // gpio ports the step and dir pins are spread over
+#define STEP_MIN_PULSE_WIDTH_US 1 // a4988 needs at least 1us
+#define STEP_DIR_SETUP_US 1 // a4988 needs 200ns between a dir change and the step pulse
+#define STEP_PULSE_TWO_PHASE true // step pins are lowered in the tick after they were raised instead of busy waiting the pulse width
 
-#define CMD_QUEUE_LENGTH 300
\ No newline at end of file
+// low power idle, loop() sleeps the core until the next interrupt (i2c, step timer, systick) whenever there is no command to execute
+// the step timer is paused while no stepper is running, so an idle module is only woken up by i2c and the systick
+#define LOW_POWER_IDLE true
+#define IDLE_STATS_INTERVAL_MS 10000 // with DEBUG, how often the share of time the core was awake is printed
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+
+// driver_auto enables the drivers when a move starts and disables them once all steppers have been idle for the hold time
+// driver_off and driver_on override that, like the enable_driver command always did
+enum driver_power_mode {driver_off = 0, driver_on = 1, driver_auto = 2};
+
+void initializeDriverPower();
+
+void setDriverMode(driver_power_mode mode);
+void setDriverIdleHoldTime(uint16_t hold_time_ms);
+
+// has to be called with the step engine locked after a command changed the steppers, so no step is made before the drivers are enabled
+void driverPowerOnCommand();
+// disables the drivers once the idle hold time is over, called from the loop
+void updateDriverPower();
@@ -3,23 +3,61 @@
 #include <Arduino.h>
 #include "config.h"
 
-enum cmd_identifier {enable_driver = 0, set_speed = 1, set_accel = 2, moveTo = 3, moveTo_extra_revs = 4, move = 5, stop = 6, wiggle = 7, moveTo_min_steps = 8};
+// every command in order of its id, with the struct of its packet and the name of its handlers
+// adding a command only takes its datastruct, an entry here and validate<name>() and execute<name>() in packet_handlers.cpp
+// a command with a payload of variable length has the payload between its datastruct and the checksum, its functions also get the payload
+#define COMMAND_LIST(X) \
+    X(enable_driver, enable_driver_datastruct, EnableDriver)          /* 0 */ \
+    X(set_speed, set_speed_datastruct, SetSpeed)                      /* 1 */ \
+    X(set_accel, set_accel_datastruct, SetAccel)                      /* 2 */ \
+    X(moveTo, moveTo_datastruct, MoveTo)                              /* 3 */ \
+    X(moveTo_extra_revs, moveTo_extra_revs_datastruct, MoveToExtraRevs) /* 4 */ \
+    X(move, move_datastruct, Move)                                    /* 5 */ \
+    X(stop, stop_datastruct, Stop)                                    /* 6 */ \
+    X(wiggle, wiggle_datastruct, Wiggle)                              /* 7 */ \
+    X(moveTo_min_steps, moveTo_min_steps_datastruct, MoveToMinSteps)  /* 8 */ \
+    X(moveTo_sync, moveTo_sync_datastruct, MoveToSync)                /* 9 */ \
+    X(set_profile, set_profile_datastruct, SetProfile)                /* 10 */ \
+    X(moveTo_duration, moveTo_duration_datastruct, MoveToDuration)    /* 11 */ \
+    X(moveTo_queued, moveTo_queued_datastruct, MoveToQueued)          /* 12 */ \
+    X(set_driver_mode, set_driver_mode_datastruct, SetDriverMode)     /* 13 */ \
+    X(moveTo_all, moveTo_all_datastruct, MoveToAll)                   /* 14 */ \
+    X(keyframe, keyframe_datastruct, Keyframe)                        /* 15 */ \
+    X(query, query_datastruct, Query)                                 /* 16 */ \
+    X(set_drain_budget, set_drain_budget_datastruct, SetDrainBudget)  /* 17 */
+
+#define COMMAND_ID(id, datastruct, name) id,
+enum cmd_identifier {COMMAND_LIST(COMMAND_ID) cmd_count};
+#undef COMMAND_ID
 enum stepper_selector {selector_minute = -3, selector_hour = -2, selector_all = -1, x1m=0, x2m=1, x3m=2, x4m=3, x1h=4, x2h=5, x3h=6, x4h=7};
 
 #define STEPPER_ID_MIN -3
 #define STEPPER_ID_MAX 7
 
 #define CMD_ID_MIN 0
-#define CMD_ID_MAX 8
+#define CMD_ID_MAX (cmd_count - 1)
 
-#define MAX_COMMAND_LENGTH 8 //max length of a command data in bytes
+#define MAX_COMMAND_LENGTH 21 //max length of a command data in bytes
+
+// setting this bit in the command id turns the stepper_id of the packet into a bitmask, bit i selects stepper i
+// so any subset of the steppers can be addressed with one packet, for every command that has a stepper_id
+#define SELECTOR_MASK_FLAG 0x80
+
+// a batch frame carries several commands in one i2c write, up to the size of the Wire buffer (32 bytes on the stm32 core)
+// BATCH_FRAME_ID, then for each command its length and its bytes without the checksum, then one checksum over the whole frame
+#define BATCH_FRAME_ID 0xFF // never a command id
+
+// a read of the master gets the running bitmap, then the query the last executed query command asked for and its answer
+// the answer is only there once the query command is executed, the master can tell by the query id in front of it
+enum query_identifier {query_none = 0, query_time_to_target = 1, query_drain_stats = 2};
+#define MAX_QUERY_REPLY_LENGTH (1 + 2 * NUM_STEPPERS) //the query id and a 2 byte value for each stepper
 
 bool isStepperIDValid(int8_t stepper_id);
 bool isCommandIDValid(uint8_t command_id);
 
 #pragma region Packet data structs
 
-#pragma pack(push, 1) // exact fit - no padding
+#pragma pack(push, 1) // exact fit - no padding, this also makes them byte aligned so packets can view them directly in the received buffer
 
 struct enable_driver_datastruct {
     uint8_t cmd_id; //1bytes
@@ -27,6 +65,13 @@ struct enable_driver_datastruct {
     uint8_t checksum; //1bytes
 };
 
+struct set_driver_mode_datastruct {
+    uint8_t cmd_id; //1bytes
+    uint8_t mode; // 0 off, 1 on, 2 auto, 1byte
+    uint16_t idle_hold_time; // in ms, how long the steppers have to be idle before auto mode disables the drivers, 2bytes
+    uint8_t checksum; //1bytes
+};
+
 struct set_speed_datastruct {
     uint8_t cmd_id; //1bytes
     uint16_t speed; //2bytes
@@ -41,6 +86,14 @@ struct set_accel_datastruct {
     uint8_t checksum; //1bytes
 };
 
+struct set_profile_datastruct {
+    uint8_t cmd_id; //1bytes
+    uint8_t profile; // 0 trapezoidal, 1 s-curve, 1byte
+    uint16_t jerk; // only used by the s-curve, 2bytes
+    int8_t stepper_id; // -1  all, -2 hour steps, -3 minute steps, 1byte 
+    uint8_t checksum; //1bytes
+};
+
 struct moveTo_datastruct {
     uint8_t cmd_id; //1bytes
     int16_t position; //2bytes
@@ -67,179 +120,109 @@ struct moveTo_min_steps_datastruct {
     uint8_t checksum; //1bytes
 };
 
-struct move_datastruct {
+struct moveTo_sync_datastruct { // moveTo_extra_revs, but speed and accel of each selected stepper are scaled so they all start and arrive together
     uint8_t cmd_id; //1bytes
-    uint16_t distance; //2bytes
-    int8_t dir; // -1 ccw, 1 cw 1byte
+    int16_t position; //2bytes
+    int8_t dir; // -1 ccw, 0 shortest path (only without extra revs), 1 cw 1byte
+    uint8_t extra_revs; //1bytes
     int8_t stepper_id; // -1  all, -2 hour steps, -3 minute steps, 1byte 
     uint8_t checksum; //1bytes
 };
 
-struct stop_datastruct {
+struct moveTo_duration_datastruct { // moveTo_extra_revs, but speed and accel are derived from how long the move should take
     uint8_t cmd_id; //1bytes
+    int16_t position; //2bytes
+    int8_t dir; // -1 ccw, 0 shortest path (only without extra revs), 1 cw 1byte
+    uint8_t extra_revs; //1bytes
+    uint16_t duration; // in ms, 2bytes
     int8_t stepper_id; // -1  all, -2 hour steps, -3 minute steps, 1byte 
     uint8_t checksum; //1bytes
 };
 
-struct wiggle_datastruct {
+struct moveTo_queued_datastruct { // moveTo_extra_revs, but starts after the previously queued moves instead of replacing the current move
     uint8_t cmd_id; //1bytes
-    uint16_t distance; //2bytes
-    int8_t dir; // -1 ccw, 1 cw 1byte
+    int16_t position; //2bytes
+    int8_t dir; // -1 ccw, 0 shortest path (only without extra revs), 1 cw 1byte
+    uint8_t extra_revs; //1bytes
     int8_t stepper_id; // -1  all, -2 hour steps, -3 minute steps, 1byte 
     uint8_t checksum; //1bytes
 };
 
-#pragma pack(pop)
-
-#pragma endregion
-
-#pragma region Abstract Packet Class
-
-//abstract class for packet data
-class CommandPacket{
-public:
-    byte buffer[MAX_COMMAND_LENGTH];
-    int bufferLength = 0;
-    bool valid = false;
-    const uint8_t commandID = 0;
-
-    CommandPacket();
-    CommandPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
-    virtual bool executeCommand() = 0;
-protected:
-    bool verifyChecksum();
-    virtual bool parseData() = 0;
-};
-
-#pragma endregion
-
-#pragma region Command Packet classes
-
-class EnableDriverPacket : public CommandPacket{
-public:
-    const uint8_t commandID = enable_driver;
-
-    EnableDriverPacket();
-    EnableDriverPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
-
-    bool executeCommand() override;
-
-private:
-    bool parseData() override;
-
-    enable_driver_datastruct data;
+struct moveTo_all_datastruct { // a target for each of the steppers, all of them are applied together
+    uint8_t cmd_id; //1bytes
+    int16_t positions[NUM_STEPPERS]; // indexed by stepper id, 16bytes
+    uint8_t cw_mask; // bit i moves stepper i cw, 1byte
+    uint8_t ccw_mask; // bit i moves stepper i ccw, steppers in neither mask take the shortest path (only without extra revs), 1byte
+    uint8_t extra_revs; // for all steppers, 1byte
+    uint8_t checksum; //1bytes
 };
 
-class SetSpeedPacket : public CommandPacket{
-public:
-    const uint8_t commandID = set_speed;
-
-    SetSpeedPacket();
-    SetSpeedPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
-
-    bool executeCommand() override;
-
-private:
-    bool parseData() override;
-    set_speed_datastruct data;
+struct keyframe_datastruct { // moves the selected steppers relative to their current targets, for streaming animations
+    uint8_t cmd_id; //1bytes
+    uint8_t stepper_mask; // bit i selects stepper i, 1byte
+    // followed by a delta for each selected stepper in order of the stepper id, then the checksum
+    // a delta in -64..63 takes 1 byte with the high bit clear, up to -16384..16383 it takes 2 bytes big endian with the high bit of the first set
+    // the master wraps the deltas into half a revolution either way, so every move fits 2 bytes and small moves 1 byte
 };
 
-class SetAccelPacket : public CommandPacket{
-public:
-    const uint8_t commandID = set_accel;
-
-    SetAccelPacket();
-    SetAccelPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
-
-    bool executeCommand() override;
-
-private:
-    bool parseData() override;
-    set_accel_datastruct data;
+struct query_datastruct {
+    uint8_t cmd_id; //1bytes
+    uint8_t query; // see query_identifier, 1byte
+    int8_t stepper_id; // -1  all, -2 hour steps, -3 minute steps, 1byte 
+    uint8_t checksum; //1bytes
+    // query_time_to_target answers the ms each selected stepper needs to reach its target, in order of the stepper id
+    // as uint16 little endian, capped at 65535, moves queued after the current one are not included
+    // query_drain_stats answers the drain budget as uint16 and the CommandDrainStats from the pass executing the last
+    // drain stats query up to the pass before this one, commands uint32, passes uint32, max_per_pass uint16,
+    // budget_exhausted uint32, all little endian
 };
 
-class MoveToPacket : public CommandPacket{
-public:
-    const uint8_t commandID = moveTo;
-
-    MoveToPacket();
-    MoveToPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
-
-    bool executeCommand() override;
-
-private:    
-    bool parseData() override;
-    moveTo_datastruct data;
+struct set_drain_budget_datastruct { // applies to the whole module
+    uint8_t cmd_id; //1bytes
+    uint16_t budget_us; // how long loop() may keep executing queued commands in one pass, 2bytes
+    uint8_t checksum; //1bytes
 };
 
-class MoveToExtraRevsPacket : public CommandPacket{
-public:
-    const uint8_t commandID = moveTo_extra_revs;
-
-    MoveToExtraRevsPacket();
-    MoveToExtraRevsPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
-
-    bool executeCommand() override;
-
-private:    
-    bool parseData() override;
-    moveTo_extra_revs_datastruct data;
+struct move_datastruct {
+    uint8_t cmd_id; //1bytes
+    uint16_t distance; //2bytes
+    int8_t dir; // -1 ccw, 1 cw 1byte
+    int8_t stepper_id; // -1  all, -2 hour steps, -3 minute steps, 1byte 
+    uint8_t checksum; //1bytes
 };
 
-class MoveToMinStepsPacket : public CommandPacket{
-public:
-    const uint8_t commandID = moveTo_min_steps;
-
-    MoveToMinStepsPacket();
-    MoveToMinStepsPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
-
-    bool executeCommand() override;
-
-private:
-    bool parseData() override;
-    moveTo_min_steps_datastruct data;
+struct stop_datastruct {
+    uint8_t cmd_id; //1bytes
+    int8_t stepper_id; // -1  all, -2 hour steps, -3 minute steps, 1byte 
+    uint8_t checksum; //1bytes
 };
 
-class MovePacket : public CommandPacket{
-public:
-    const uint8_t commandID = move;
-
-    MovePacket();
-    MovePacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
-
-    bool executeCommand() override;
-
-private:
-    bool parseData() override;
-    move_datastruct data;
+struct wiggle_datastruct {
+    uint8_t cmd_id; //1bytes
+    uint16_t distance; //2bytes
+    int8_t dir; // -1 ccw, 1 cw 1byte
+    int8_t stepper_id; // -1  all, -2 hour steps, -3 minute steps, 1byte 
+    uint8_t checksum; //1bytes
 };
 
-class StopPacket : public CommandPacket{
-public:
-    const uint8_t commandID = stop;
+#pragma pack(pop)
 
-    StopPacket();
-    StopPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
+#pragma endregion
 
-    bool executeCommand() override;
+#pragma region Command dispatch
 
-private:
-    bool parseData() override;
-    stop_datastruct data;
+//entry of the dispatch table, both functions get the buffer the command was received in and view it as the packet struct
+struct CommandEntry{
+    bool (*validate)(const byte *buffer, uint8_t bufferLength); //checks the length and the values of the packet
+    void (*execute)(const byte *buffer, uint8_t bufferLength); //has to be called with the steppers select() returns locked
+    uint8_t (*select)(const byte *buffer, uint8_t bufferLength); //mask of the steppers the command changes
 };
 
-class WigglePacket : public CommandPacket{
-public:
-    const uint8_t commandID = wiggle;
-
-    WigglePacket();
-    WigglePacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength);
+//returns the table entry of a received command if its id, checksum, length and values are valid, nullptr otherwise
+const CommandEntry *parseCommand(const byte *buffer, uint8_t bufferLength);
 
-    bool executeCommand() override;
-
-private:
-    bool parseData() override;
-    wiggle_datastruct data;
-};
+//copies the answer of the last query to buffer, which has to hold MAX_QUERY_REPLY_LENGTH bytes, returns its length
+//only called from the i2c request interrupt
+uint8_t queryReply(byte *buffer);
 
 #pragma endregion
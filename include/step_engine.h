@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "steppers.h"
+
+// on the stm32 the steps are generated from a hardware timer interrupt, everywhere else (e.g. a host build)
+// stepEnginePoll() has to be called from the loop and runs the same tick function
+#if defined(ARDUINO_ARCH_STM32) && STEP_TIMER_ENABLED
+  #define STEP_ENGINE_USE_TIMER true
+#else
+  #define STEP_ENGINE_USE_TIMER false
+#endif
+
+void initializeStepEngine();
+
+// runs the steppers that are due, called from the timer interrupt at the next step deadline
+void stepEngineTick();
+
+// runs the tick when no hardware timer is used, otherwise plans the upcoming steps of all steppers ahead of the interrupt
+void stepEnginePoll();
+
+// how long the loop may be busy before stepEnginePoll() is late, without the timer that is the next step deadline
+// with the timer steps are never late, running out of planned steps only makes the interrupt compute the ramp itself
+unsigned long stepEngineTimeUntilPoll();
+
+// true if no stepper is scheduled and no step pulse is left to finish, the step timer is paused then
+bool stepEngineIdle();
+
+// everything that changes stepper state outside of the tick has to be wrapped in these
+// the tick leaves the locked steppers alone while all others keep stepping, so interrupts stay enabled during a command
+// unlocking reschedules the locked steppers and enables the drivers if they are in auto mode and a stepper has to move
+void stepEngineLock(uint8_t stepper_mask = STEPPER_MASK_ALL);
+void stepEngineUnlock();
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+#include <AccelStepper.h>
+#include "config.h"
+
+// the batched output writes the gpio port registers directly, everywhere else the steppers fall back to digitalWrite
+#if defined(ARDUINO_ARCH_STM32) && STEP_OUTPUT_BATCHED
+  #define STEP_OUTPUT_USE_PORTS true
+#else
+  #define STEP_OUTPUT_USE_PORTS false
+#endif
+
+#define STEP_OUTPUT_NO_PORT 0xFF
+
+// collects the step and dir pins of all steppers that step in one tick and outputs them with a single
+// register write per gpio port, so steps that are due at the same time actually happen at the same time
+class StepOutputBatch{
+public:
+    //returns the index of the port the pin belongs to, registering the port if it isnt known yet
+    //STEP_OUTPUT_NO_PORT if STEP_OUTPUT_MAX_PORTS ports are registered already
+    uint8_t registerPort(uint8_t pin);
+    void addStep(uint8_t step_port, uint32_t step_mask, uint8_t dir_port, uint32_t dir_mask, bool dir);
+    //sets the dir pins, then raises all collected step pins
+    //with STEP_PULSE_TWO_PHASE the step pins are lowered by the next flush, otherwise after busy waiting the pulse width
+    void flush();
+    //true if no step is waiting for the next flush and no step pin is still high
+    bool isIdle();
+
+private:
+#if STEP_OUTPUT_USE_PORTS
+    GPIO_TypeDef *ports[STEP_OUTPUT_MAX_PORTS];
+    uint8_t num_ports;
+
+    //values for the BSRR register of each port, lower half sets pins, upper half resets them
+    uint32_t dir_bits[STEP_OUTPUT_MAX_PORTS];
+    uint32_t step_bits[STEP_OUTPUT_MAX_PORTS];
+    bool pending;
+
+    //step pins that are still high from the previous flush
+    uint32_t step_high_bits[STEP_OUTPUT_MAX_PORTS];
+    bool pulse_high;
+    unsigned long pulse_start;
+
+    void lowerStepPins();
+#endif
+};
+
+extern StepOutputBatch step_output;
+
+// driver stepper that hands its steps to the step_output batch instead of writing the pins itself
+class BatchedStepper final : public AccelStepper{
+public:
+    BatchedStepper(uint8_t step_pin, uint8_t dir_pin, uint16_t stepsPerRevolution);
+
+protected:
+    void step1(long step) final;
+
+private:
+#if STEP_OUTPUT_USE_PORTS
+    uint8_t step_port;
+    uint8_t dir_port;
+    uint32_t step_mask;
+    uint32_t dir_mask;
+    //false if a pin is on a port the batch has no room for
+    bool batched;
+#endif
+};
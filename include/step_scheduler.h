@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+
+// keeps the time at which each stepper has to run next in a min heap, so a tick only touches the steppers that are due
+// steppers at rest are not in the heap at all and cost nothing
+class StepScheduler{
+public:
+    StepScheduler();
+
+    //updates the deadline of a stepper from its current state, has to be called whenever the stepper state changes
+    void reschedule(uint8_t stepper_index, unsigned long now);
+    void rescheduleAll(unsigned long now);
+    //runs every stepper whose deadline is reached, each at most once per call and all with the same time sample
+    //due steppers in locked_mask are only dropped from the heap, they are run again once they are rescheduled
+    void runDue(unsigned long now, uint8_t locked_mask);
+    //microseconds until the earliest deadline, 0 if it already passed and ULONG_MAX if no stepper is scheduled
+    unsigned long timeUntilNext(unsigned long now);
+    //true if no stepper is scheduled
+    bool isEmpty();
+
+private:
+    //stepper indices, heap[0] has the earliest deadline
+    uint8_t heap[NUM_STEPPERS];
+    uint8_t heap_size;
+    //position of each stepper in the heap, -1 if it isnt scheduled
+    int8_t heap_position[NUM_STEPPERS];
+    unsigned long deadline[NUM_STEPPERS];
+
+    bool isEarlier(uint8_t heap_index_a, uint8_t heap_index_b);
+    void swap(uint8_t heap_index_a, uint8_t heap_index_b);
+    void siftUp(uint8_t heap_index);
+    void siftDown(uint8_t heap_index);
+    void remove(uint8_t stepper_index);
+};
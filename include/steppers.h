@@ -2,9 +2,31 @@
 
 #include <Arduino.h>
 #include <AccelStepper.h>
+#include "config.h"
+#include "step_output.h"
 
-extern AccelStepper *steppers[8];
-extern AccelStepper *h_steppers[4];
-extern AccelStepper *m_steppers[4];
+// groups of steppers are bitmasks over the stepper index, minute steppers are 0-3 and hour steppers 4-7
+#define STEPPER_MASK_M 0x0F
+#define STEPPER_MASK_H 0xF0
+#define STEPPER_MASK_ALL 0xFF
 
-void initializeSteppers();
\ No newline at end of file
+// all steppers of the module in one contiguous array, the index is the stepper id of the packets
+class StepperBank{
+public:
+    StepperBank();
+
+    AccelStepper &operator[](uint8_t stepper_index) { return steppers[stepper_index]; }
+
+    //bit i is set while stepper i is running to its target or has queued moves left
+    uint8_t runningMask() { return running_mask; }
+    //has to be called whenever the state of a stepper changes, the step scheduler does it whenever it reschedules
+    void updateRunning(uint8_t stepper_index);
+
+private:
+    BatchedStepper steppers[NUM_STEPPERS];
+    volatile uint8_t running_mask;
+};
+
+extern StepperBank stepper_bank;
+
+void initializeSteppers();
@@ -20,19 +20,78 @@ void dump(uint8_t* p, int l)
 }
 #endif
 
+#if ACCELSTEPPER_RAMP_TABLE_LENGTH
+// R_n of AccelRampTable as Q1.31 fixed point, R_0 = 1 is the largest ratio
+#define RAMP_RATIO_FRACTION_BITS 31
+
+// Built by the compiler, so it is read only data in flash instead of a copy in RAM
+struct AccelRampRatios
+{
+    uint32_t ratio[ACCELSTEPPER_RAMP_TABLE_LENGTH];
+
+    constexpr AccelRampRatios() : ratio()
+    {
+	double r = 1.0;
+	for (long n = 0; n < ACCELSTEPPER_RAMP_TABLE_LENGTH; n++)
+	{
+	    if (n > 0)
+		r = r * ((4.0 * n) - 1) / ((4.0 * n) + 1); // Equation 13
+	    ratio[n] = (uint32_t)(r * (1UL << RAMP_RATIO_FRACTION_BITS) + 0.5);
+	}
+    }
+};
+
+static constexpr AccelRampRatios rampRatios;
+#endif
+
+bool AccelRampTable::contains(long n)
+{
+    return (n > 0 ? n : -n - 1) < ACCELSTEPPER_RAMP_TABLE_LENGTH;
+}
+
+ramp_t AccelRampTable::interval(ramp_t c0, long n)
+{
+#if ACCELSTEPPER_RAMP_TABLE_LENGTH
+    // Decelerating at -n undoes the accelerating step n, so it ends at the interval before it
+    uint32_t ratio = rampRatios.ratio[n > 0 ? n : -n - 1];
+#if ACCELSTEPPER_FIXED_POINT
+    return (ramp_t)(((int64_t)c0 * ratio) >> RAMP_RATIO_FRACTION_BITS); // a single 32x32 bit multiplication
+#else
+    return c0 * ((float)ratio / (float)(1UL << RAMP_RATIO_FRACTION_BITS));
+#endif
+#else
+    (void)(n); // Unused
+    return c0;
+#endif
+}
+
 AccelStepper::AccelStepper(uint8_t pin1, uint8_t pin2, uint16_t stepsPerRevolution)
 {
+#if !ACCELSTEPPER_DRIVER_ONLY
     _interface = DRIVER;
+#endif
     _currentPos = 0;
     _targetPos = 0;
+#if !ACCELSTEPPER_FIXED_POINT
     _speed = 0.0;
+#endif
     _maxSpeed = 1.0;
     _acceleration = 0.0;
+    _baseMaxSpeed = 1.0;
+    _baseAcceleration = 0.0;
+    _profileScale = 1.0;
+    _minScaledSpeed = _minScaledAcceleration = 0.0;
+    _maxScaledSpeed = _maxScaledAcceleration = INFINITY;
+    _profile = PROFILE_TRAPEZOIDAL;
+    _jerk = _baseJerk = 1.0;
     _sqrt_twoa = 1.0;
     _stepInterval = 0;
     _minPulseWidth = 1;
+    _twoPhasePulse = false;
+    _stepPinHigh = false;
     _enablePin = 0xff;
     _lastStepTime = 0;
+    _stepPinHighTime = 0;
     this->pin[0] = pin1;
     this->pin[1] = pin2;
     this->pin[2] = 0;
@@ -47,9 +106,17 @@ AccelStepper::AccelStepper(uint8_t pin1, uint8_t pin2, uint16_t stepsPerRevoluti
 
     // NEW
     _n = 0;
-    _c0 = 0.0;
-    _cn = 0.0;
-    _cmin = 1.0;
+    _c0 = 0;
+    _cn = 0;
+    _cmin = RAMP_FROM_FLOAT(1.0);
+    _queueHead = 0;
+    _queueLength = 0;
+    _planVersion = 0;
+    _stepCount = 0;
+#if ACCELSTEPPER_PLAN_LENGTH
+    _planHead = _planTail = 0;
+    _planLast.version = _planVersion - 1;
+#endif
     _direction = DIRECTION_CCW;
 
     int i;
@@ -65,13 +132,24 @@ void AccelStepper::move(long relative)
 }
 
 void AccelStepper::moveTo(long absolute)
+{
+    _queueLength = 0;
+    if (_profileScale != 1.0)
+	setProfileScale(1.0);
+    setTarget(absolute);
+}
+
+void AccelStepper::setTarget(long absolute)
 {
     isWiggling = 0;
     if (_targetPos != absolute)
     {
+	invalidatePlan();
 	_targetPos = absolute;
-	computeNewSpeed();
-	// compute new n?
+	// a move from rest gets the s-curve for its distance, see updateSCurve()
+	if (_profile == PROFILE_SCURVE && (_n == 0 || _n == 1))
+	    updateSCurve();
+	updateRamp();
     }
 }
 
@@ -82,15 +160,24 @@ void AccelStepper::moveTarget(long relative)
 }
 
 void AccelStepper::moveToSingleRevolution(long absolute, int8_t dir)
+{
+    move(distanceToSingleRevolution(absolute, dir));
+}
+
+long AccelStepper::distanceToSingleRevolution(long absolute, int8_t dir)
 {
     normalizePosition();
+    return singleRevolutionDistance(_currentPos, absolute, dir);
+}
 
+long AccelStepper::singleRevolutionDistance(long from, long absolute, int8_t dir)
+{
     absolute = (absolute % stepsPerRevolution + stepsPerRevolution) % stepsPerRevolution; // normalize absolute, (a%b + b)%b to avoid negative remainder
 
     short movement;
 
     if(dir == 0){
-        movement = absolute - _currentPos;
+        movement = absolute - from;
         //if bigger than semi circle in cw direction move ccw
         if (movement > stepsPerRevolution/2){
             movement -= stepsPerRevolution;
@@ -101,23 +188,189 @@ void AccelStepper::moveToSingleRevolution(long absolute, int8_t dir)
         }
     }else{
         // move from normalized current post to normalized given absolute position
-        movement = (absolute - _currentPos + stepsPerRevolution * dir) % stepsPerRevolution;
+        movement = (absolute - from + stepsPerRevolution * dir) % stepsPerRevolution;
     }
 
-
-    move(movement);
+    return movement;
 }
 
 void AccelStepper::moveToExtraRevolutions(long absolute, int8_t dir, uint8_t extra_revs) // shitty name, like move to single revolution but allows multiple extra rotations
+{
+    move(distanceToExtraRevolutions(absolute, dir, extra_revs));
+}
+
+long AccelStepper::distanceToExtraRevolutions(long absolute, int8_t dir, uint8_t extra_revs)
 {
     normalizePosition();
+    return extraRevolutionsDistance(_currentPos, absolute, dir, extra_revs);
+}
 
+long AccelStepper::extraRevolutionsDistance(long from, long absolute, int8_t dir, uint8_t extra_revs)
+{
     absolute = (absolute % stepsPerRevolution + stepsPerRevolution) % stepsPerRevolution; // normalize absolute, (a%b + b)%b to avoid negative remainder
 
     // move from normalized current post to normalized given absolute position
-    short movement = (absolute - _currentPos + stepsPerRevolution * dir) % stepsPerRevolution;
+    short movement = (absolute - from + stepsPerRevolution * dir) % stepsPerRevolution;
+
+    return movement + stepsPerRevolution * extra_revs * dir;
+}
+
+void AccelStepper::moveScaled(long relative, float scale)
+{
+    _queueLength = 0;
+    setProfileScale(scale);
+    setTarget(_currentPos + relative);
+}
+
+void AccelStepper::moveToDuration(long absolute, int8_t dir, uint8_t extra_revs, float duration)
+{
+    long distance;
+    if (extra_revs == 0)
+	distance = distanceToSingleRevolution(absolute, dir);
+    else
+	distance = distanceToExtraRevolutions(absolute, dir, extra_revs);
 
-    move(movement + stepsPerRevolution * extra_revs * dir);
+    moveScaled(distance, profileScaleForDuration(distance, duration));
+}
+
+bool AccelStepper::queueMoveTo(long absolute, int8_t dir, uint8_t extra_revs)
+{
+    // the queued moves continue from where the last one ends
+    long end = _targetPos;
+    for (uint8_t i = 0; i < _queueLength; i++)
+	end += _queue[(_queueHead + i) % ACCELSTEPPER_QUEUE_LENGTH];
+    end = (end % stepsPerRevolution + stepsPerRevolution) % stepsPerRevolution;
+
+    long relative;
+    if (extra_revs == 0)
+	relative = singleRevolutionDistance(end, absolute, dir);
+    else
+	relative = extraRevolutionsDistance(end, absolute, dir, extra_revs);
+    if (relative == 0)
+	return true;
+
+    isWiggling = 0;
+
+    if (_queueLength == 0)
+    {
+	long distanceTo = distanceToGo();
+	if (!isRunning())
+	{
+	    if (_profileScale != 1.0)
+		setProfileScale(1.0);
+	    setTarget(_targetPos + relative);
+	    return true;
+	}
+	if (distanceTo != 0 && (distanceTo > 0) == (relative > 0))
+	{
+	    // goes on in the same direction, the running move just gets longer and does not slow down in between
+	    setTarget(_targetPos + relative);
+	    return true;
+	}
+    }
+    else
+    {
+	long &last = _queue[(_queueHead + _queueLength - 1) % ACCELSTEPPER_QUEUE_LENGTH];
+	if ((last > 0) == (relative > 0))
+	{
+	    last += relative;
+	    return true;
+	}
+    }
+
+    if (_queueLength == ACCELSTEPPER_QUEUE_LENGTH)
+	return false;
+    _queue[(_queueHead + _queueLength) % ACCELSTEPPER_QUEUE_LENGTH] = relative;
+    _queueLength++;
+    return true;
+}
+
+uint8_t AccelStepper::queuedMoves()
+{
+    return _queueLength;
+}
+
+void AccelStepper::startQueuedMove()
+{
+    // queueMoveTo() already joined moves in the same direction, so this is the move up to the next reversal
+    long relative = _queue[_queueHead];
+    _queueHead = (_queueHead + 1) % ACCELSTEPPER_QUEUE_LENGTH;
+    _queueLength--;
+
+    if (_profileScale != 1.0)
+	setProfileScale(1.0);
+    setTarget(_targetPos + relative);
+}
+
+void AccelStepper::setScaleLimits(float minSpeed, float maxSpeed, float minAcceleration, float maxAcceleration)
+{
+    _minScaledSpeed = minSpeed;
+    _maxScaledSpeed = maxSpeed;
+    _minScaledAcceleration = minAcceleration;
+    _maxScaledAcceleration = maxAcceleration;
+}
+
+float AccelStepper::rampDuration()
+{
+    // unchanged by the profile scale, as speed, acceleration and jerk all scale together
+    if (_profile != PROFILE_SCURVE)
+	return _baseMaxSpeed / _baseAcceleration;
+    return sCurveRampDuration(_baseMaxSpeed, _baseAcceleration, _baseJerk);
+}
+
+float AccelStepper::moveDuration(long distance)
+{
+    float d = labs(distance);
+    float v = _baseMaxSpeed;
+    float rampTime = rampDuration();
+
+    // accelerating and decelerating together cover v * rampTime steps in 2 * rampTime
+    if (d >= v * rampTime)
+	return d / v + rampTime; // reaches max speed
+    if (_profile == PROFILE_SCURVE)
+    {
+	// the ramp of a short move peaks halfway, see updateSCurve()
+	float peak = sCurvePeakSpeed(d / 2.0, _baseAcceleration, _baseJerk);
+	return 2.0 * sCurveRampDuration(peak, _baseAcceleration, _baseJerk);
+    }
+    return 2.0 * sqrt(d / _baseAcceleration); // triangular
+}
+
+float AccelStepper::profileScaleForDuration(long distance, float duration)
+{
+    float d = labs(distance);
+    float v = _baseMaxSpeed;
+    float rampTime = rampDuration();
+
+    if (duration > rampTime)
+    {
+	float scale = d / (v * (duration - rampTime));
+	if (d >= scale * v * rampTime)
+	    return scale; // still reaches the scaled max speed
+    }
+    if (_profile == PROFILE_SCURVE)
+    {
+	// moveDuration() of the short s-curve solved for the scale, each half of the move is a ramp of duration t
+	float a = _baseAcceleration;
+	float j = _baseJerk;
+	float t = duration / 2.0;
+	if (t >= 2.0 * a / j)
+	    return d / (a * (t - a / j) * t); // reaches the scaled max acceleration
+	return 4.0 * d / (j * t * t * t);
+    }
+    return 4.0 * d / (_baseAcceleration * duration * duration);
+}
+
+void AccelStepper::setProfileScale(float scale)
+{
+    // outside the limits the move takes longer or shorter than planned
+    scale = max(scale, max(_minScaledSpeed / _baseMaxSpeed, _minScaledAcceleration / _baseAcceleration));
+    scale = min(scale, min(_maxScaledSpeed / _baseMaxSpeed, _maxScaledAcceleration / _baseAcceleration));
+    _profileScale = scale;
+    // scaling the jerk as well keeps the shape of the s-curve, like speed and acceleration do for the trapezoid
+    _jerk = _baseJerk * scale;
+    applyMaxSpeed(_baseMaxSpeed * scale);
+    applyAcceleration(_baseAcceleration * scale);
 }
 
 void AccelStepper::moveToMinSteps(long absolute, int8_t dir, uint16_t min_steps) // shitty name, like move to single revolution but allows multiple extra rotations
@@ -139,6 +392,7 @@ void AccelStepper::moveToMinSteps(long absolute, int8_t dir, uint16_t min_steps)
 }
 
 void AccelStepper::normalizePosition(){
+    invalidatePlan();
     long distToGo = distanceToGo();
     _currentPos = (_currentPos % stepsPerRevolution + stepsPerRevolution) % stepsPerRevolution;;
     _targetPos = _currentPos + distToGo;
@@ -182,12 +436,24 @@ void AccelStepper::doWiggle()
 // returns true if a step occurred
 bool AccelStepper::runSpeed()
 {
+    return runSpeed(micros());
+}
+
+bool AccelStepper::runSpeed(unsigned long now)
+{
+    // Finish the pulse of the last step, also after the last step of a move
+    if (_stepPinHigh && now - _stepPinHighTime >= _minPulseWidth)
+    {
+	setOutputPins(_direction ? 0b10 : 0b00); // step LOW
+	_stepPinHigh = false;
+    }
+
     // Dont do anything unless we actually have a step interval
     if (!_stepInterval)
 	return false;
 
-    unsigned long time = micros();   
-    if (time - _lastStepTime >= _stepInterval)
+    unsigned long elapsed = now - _lastStepTime;
+    if (elapsed >= _stepInterval)
     {
 	if (_direction == DIRECTION_CW)
 	{
@@ -200,8 +466,16 @@ bool AccelStepper::runSpeed()
 	    _currentPos -= 1;
 	}
 	step(_currentPos);
-
-	_lastStepTime = time; // Caution: does not account for costs in step()
+	_stepCount++;
+	_stepPinHighTime = now;
+
+	// Count the interval from when the step was due, not from when it was taken, so the time a step is late
+	// by (waiting for the call, the costs in step()) does not add up over a move.
+	// After a pause of more than an interval, e.g. when starting from rest, it starts over from now instead.
+	if (elapsed - _stepInterval < _stepInterval)
+	    _lastStepTime += _stepInterval;
+	else
+	    _lastStepTime = now;
 
 	return true;
     }
@@ -230,24 +504,78 @@ long AccelStepper::currentPosition()
 // Sets speed to 0
 void AccelStepper::setCurrentPosition(long position)
 {
+    invalidatePlan();
+    _queueLength = 0;
     _targetPos = _currentPos = position;
     _n = 0;
     _stepInterval = 0;
+#if !ACCELSTEPPER_FIXED_POINT
     _speed = 0.0;
+#endif
+}
+
+void AccelStepper::updateRamp()
+{
+    // A running stepper picks up the change with its next step, so the ramp carries on from the current speed.
+    // Advancing the ramp here would account for a step that is never taken.
+    if (_stepInterval == 0 || (distanceToGo() == 0 && stepsToStop() <= 1))
+	computeNewSpeed();
+}
+
+float AccelStepper::timeToTarget()
+{
+    float d = distanceToGo();
+    float v = speed();
+    float a = _acceleration;
+    // mirrored so the target is ahead
+    if (d < 0)
+    {
+	d = -d;
+	v = -v;
+    }
+
+    float stopDistance = v * v / (2.0 * a); // Equation 16
+    if (v < 0)
+	return -v / a + rampTime(d + stopDistance, 0); // moving away, stop and move the whole way back
+    if (stopDistance > d)
+	return v / a + rampTime(stopDistance - d, 0); // too fast to stop in time, overshoot and come back
+    return rampTime(d, v);
+}
+
+float AccelStepper::rampTime(float distance, float speed)
+{
+    float a = _acceleration;
+    float v = _maxSpeed;
+    // accelerating from speed to the peak and decelerating from there to 0 covers the distance
+    float peak = sqrt(a * distance + speed * speed / 2.0);
+    if (peak <= v)
+	return (2.0 * peak - speed) / a;
+    float rampDistance = (2.0 * v * v - speed * speed) / (2.0 * a);
+    return (2.0 * v - speed) / a + (distance - rampDistance) / v;
 }
 
 void AccelStepper::computeNewSpeed()
 {
-    long distanceTo = distanceToGo(); // +ve is clockwise from curent location
+    AccelStepPlan ramp;
+    savePlanState(ramp);
+    computeNewSpeed(ramp, _targetPos, _c0, cruiseInterval());
+    loadPlanState(ramp);
+}
+
+void AccelStepper::computeNewSpeed(AccelStepPlan &ramp, long target, ramp_t c0, ramp_t cmin)
+{
+    long distanceTo = target - ramp.position; // +ve is clockwise from curent location
 
-    long stepsToStop = (long)((_speed * _speed) / (2.0 * _acceleration)); // Equation 16
+    long stepsToStop = this->stepsToStop(ramp);
 
     if (distanceTo == 0 && stepsToStop <= 1)
     {
 	// We are at the target and its time to stop
-	_stepInterval = 0;
-	_speed = 0.0;
-	_n = 0;
+	ramp.interval = 0;
+#if !ACCELSTEPPER_FIXED_POINT
+	ramp.speed = 0.0;
+#endif
+	ramp.n = 0;
 	return;
     }
 
@@ -255,63 +583,85 @@ void AccelStepper::computeNewSpeed()
     {
 	// We are anticlockwise from the target
 	// Need to go clockwise from here, maybe decelerate now
-	if (_n > 0)
+	if (ramp.n > 0)
 	{
 	    // Currently accelerating, need to decel now? Or maybe going the wrong way?
-	    if ((stepsToStop >= distanceTo) || _direction == DIRECTION_CCW)
-		_n = -stepsToStop; // Start deceleration
+	    if ((stepsToStop >= distanceTo) || ramp.direction == DIRECTION_CCW)
+		ramp.n = -stepsToStop; // Start deceleration
 	}
-	else if (_n < 0)
+	else if (ramp.n < 0)
 	{
 	    // Currently decelerating, need to accel again?
-	    if ((stepsToStop < distanceTo) && _direction == DIRECTION_CW)
-		_n = -_n; // Start accceleration
+	    if ((stepsToStop < distanceTo) && ramp.direction == DIRECTION_CW && ramp.cn >= cmin)
+		ramp.n = -ramp.n; // Start accceleration
 	}
     }
     else if (distanceTo < 0)
     {
 	// We are clockwise from the target
 	// Need to go anticlockwise from here, maybe decelerate
-	if (_n > 0)
+	if (ramp.n > 0)
 	{
 	    // Currently accelerating, need to decel now? Or maybe going the wrong way?
-	    if ((stepsToStop >= -distanceTo) || _direction == DIRECTION_CW)
-		_n = -stepsToStop; // Start deceleration
+	    if ((stepsToStop >= -distanceTo) || ramp.direction == DIRECTION_CW)
+		ramp.n = -stepsToStop; // Start deceleration
 	}
-	else if (_n < 0)
+	else if (ramp.n < 0)
 	{
 	    // Currently decelerating, need to accel again?
-	    if ((stepsToStop < -distanceTo) && _direction == DIRECTION_CCW)
-		_n = -_n; // Start accceleration
+	    if ((stepsToStop < -distanceTo) && ramp.direction == DIRECTION_CCW && ramp.cn >= cmin)
+		ramp.n = -ramp.n; // Start accceleration
 	}
     }
 
+    // Faster than the max speed, e.g. after it was lowered during the move, decelerate down to it
+    if (ramp.n > 0 && ramp.cn < cmin)
+	ramp.n = -stepsToStop;
+
     // Need to accelerate or decelerate
-    if (_n == 0)
+    if (ramp.n == 0)
     {
 	// First step from stopped
-	_cn = _c0;
-	_direction = (distanceTo > 0) ? DIRECTION_CW : DIRECTION_CCW;
+	ramp.cn = (_profile == PROFILE_SCURVE) ? sCurveInterval(0, cmin) : c0;
+	ramp.direction = (distanceTo > 0) ? DIRECTION_CW : DIRECTION_CCW;
     }
     else
     {
 	// Subsequent step. Works for accel (n is +_ve) and decel (n is -ve).
-	_cn = _cn - ((2.0 * _cn) / ((4.0 * _n) + 1)); // Equation 13
-	_cn = max(_cn, _cmin); 
+	if (_profile == PROFILE_SCURVE)
+	    ramp.cn = sCurveInterval(ramp.n, cmin);
+	else if (AccelRampTable::contains(ramp.n))
+	    ramp.cn = AccelRampTable::interval(c0, ramp.n); // Equation 13, precomputed
+	else
+	{
+#if ACCELSTEPPER_FIXED_POINT
+	    ramp.cn = ramp.cn - ((2 * ramp.cn) / ((4 * ramp.n) + 1)); // Equation 13, a single integer division
+#else
+	    ramp.cn = ramp.cn - ((2.0 * ramp.cn) / ((4.0 * ramp.n) + 1)); // Equation 13
+#endif
+	}
+	if (ramp.n > 0 && ramp.cn <= cmin)
+	{
+	    ramp.cn = cmin;
+	    // Cruising at max speed, hold n so it stays the number of steps needed to stop
+	    if (holdsRampIndex() && ramp.n > 0)
+		ramp.n--;
+	}
     }
-    _n++;
-    _stepInterval = _cn;
-    _speed = 1000000.0 / _cn;
-    if (_direction == DIRECTION_CCW)
-	_speed = -_speed;
+    ramp.n++;
+    ramp.interval = RAMP_TO_US(ramp.cn);
+#if !ACCELSTEPPER_FIXED_POINT
+    ramp.speed = 1000000.0 / ramp.cn;
+    if (ramp.direction == DIRECTION_CCW)
+	ramp.speed = -ramp.speed;
+#endif
 
 #if 0
-    Serial.println(_speed);
     Serial.println(_acceleration);
-    Serial.println(_cn);
-    Serial.println(_c0);
-    Serial.println(_n);
-    Serial.println(_stepInterval);
+    Serial.println(ramp.cn);
+    Serial.println(c0);
+    Serial.println(ramp.n);
+    Serial.println(ramp.interval);
     Serial.println(distanceTo);
     Serial.println(stepsToStop);
     Serial.println("-----");
@@ -323,73 +673,348 @@ void AccelStepper::computeNewSpeed()
 // If the motor is in the desired position, the cost is very small
 // returns true if the motor is still running to the target position.
 bool AccelStepper::run()
+{
+    return run(micros());
+}
+
+bool AccelStepper::run(unsigned long now)
 {
     doWiggle();
-    if (runSpeed())
+    if (_queueLength && !isRunning())
+	startQueuedMove();
+    if (runSpeed(now) && !takePlannedStep())
 	computeNewSpeed();
-    return _speed != 0.0 || distanceToGo() != 0;
+    return _stepInterval != 0 || distanceToGo() != 0;
+}
+
+void AccelStepper::invalidatePlan()
+{
+    _planVersion++;
+}
+
+bool AccelStepper::takePlannedStep()
+{
+#if ACCELSTEPPER_PLAN_LENGTH
+    // skip steps that are outdated or were already taken without the plan
+    while (_planHead != _planTail)
+    {
+	AccelStepPlan &plan = _plan[_planHead];
+	_planHead = (_planHead + 1) % ACCELSTEPPER_PLAN_LENGTH;
+	if (plan.version == _planVersion && plan.step == _stepCount)
+	{
+	    loadPlanState(plan);
+	    return true;
+	}
+    }
+#endif
+    return false;
+}
+
+void AccelStepper::savePlanState(AccelStepPlan &plan)
+{
+    plan.step = _stepCount;
+    plan.position = _currentPos;
+    plan.n = _n;
+    plan.cn = _cn;
+    plan.interval = _stepInterval;
+#if !ACCELSTEPPER_FIXED_POINT
+    plan.speed = _speed;
+#endif
+    plan.direction = _direction;
+    plan.version = _planVersion;
+}
+
+void AccelStepper::loadPlanState(const AccelStepPlan &plan)
+{
+    _stepCount = plan.step;
+    _currentPos = plan.position;
+    _n = plan.n;
+    _cn = plan.cn;
+    _stepInterval = plan.interval;
+#if !ACCELSTEPPER_FIXED_POINT
+    _speed = plan.speed;
+#endif
+    _direction = plan.direction;
+}
+
+uint8_t AccelStepper::planSteps()
+{
+#if ACCELSTEPPER_PLAN_LENGTH
+    uint8_t buffered = (_planTail - _planHead + ACCELSTEPPER_PLAN_LENGTH) % ACCELSTEPPER_PLAN_LENGTH;
+
+    // nothing to plan at rest, and one slot stays free to tell a full ring from an empty one
+    if (!_stepInterval || buffered >= ACCELSTEPPER_PLAN_LENGTH - 1)
+	return buffered;
+
+    // copy only the state run() changes, the rest of what computeNewSpeed() reads changes together with _planVersion
+    AccelStepPlan ramp;
+    noInterrupts();
+    savePlanState(ramp);
+    long target = _targetPos;
+    ramp_t c0 = _c0;
+    ramp_t cmin = cruiseInterval();
+    interrupts();
+
+    // start over from the current state if the plan is outdated or used up, run() skips whatever is still buffered
+    if (_planLast.version == ramp.version && buffered != 0)
+	ramp = _planLast; // continue after the last planned step
+
+    while (buffered < ACCELSTEPPER_PLAN_LENGTH - 1 && ramp.interval)
+    {
+	ramp.position += (ramp.direction == DIRECTION_CW) ? 1 : -1;
+	ramp.step++;
+	computeNewSpeed(ramp, target, c0, cmin);
+
+	_plan[_planTail] = ramp;
+	__sync_synchronize(); // the step has to be complete before run() can see it
+	_planTail = (_planTail + 1) % ACCELSTEPPER_PLAN_LENGTH;
+	buffered++;
+    }
+    _planLast = ramp;
+    return buffered;
+#else
+    return 0;
+#endif
 }
 
 void AccelStepper::setMaxSpeed(float speed)
 {
     if (speed < 0.0)
        speed = -speed;
+    _baseMaxSpeed = speed;
+    applyMaxSpeed(speed * _profileScale);
+}
+
+void AccelStepper::applyMaxSpeed(float speed)
+{
+    invalidatePlan();
     if (_maxSpeed != speed)
     {
 	_maxSpeed = speed;
-	_cmin = 1000000.0 / speed;
+	_cmin = RAMP_FROM_FLOAT(1000000.0 / speed);
+	updateSCurve();
 	// Recompute _n from current speed and adjust speed if accelerating or cruising
 	if (_n > 0)
 	{
-	    _n = (long)((_speed * _speed) / (2.0 * _acceleration)); // Equation 16
-	    computeNewSpeed();
+	    // When the ramp index is held it already is the number of steps needed to stop from the current speed
+	    // Above the new max speed, computeNewSpeed() decelerates down to it with the next steps
+	    _n = stepsToStop(); // Equation 16
+	    updateRamp();
 	}
     }
 }
 
 float   AccelStepper::maxSpeed()
 {
-    return _maxSpeed;
+    return _baseMaxSpeed;
+}
+
+float   AccelStepper::acceleration()
+{
+    return _baseAcceleration;
 }
 
-float AccelStepper::setAcceleration(float acceleration)
+ramp_t AccelStepper::setAcceleration(float acceleration)
 {
     if (acceleration == 0.0){
 	    return _c0;
     }if (acceleration < 0.0){
       acceleration = -acceleration;
-    }if (_acceleration != acceleration)
+    }
+    _baseAcceleration = acceleration;
+    return applyAcceleration(acceleration * _profileScale);
+}
+
+ramp_t AccelStepper::applyAcceleration(float acceleration)
+{
+    invalidatePlan();
+    if (_acceleration != acceleration)
     {
 	// Recompute _n per Equation 17
 	_n = _n * (_acceleration / acceleration);
 	// New c0 per Equation 7, with correction per Equation 15
-	_c0 = 0.676 * sqrt(2.0 / acceleration) * 1000000.0; // Equation 15
+	_c0 = RAMP_FROM_FLOAT(0.676 * sqrt(2.0 / acceleration) * 1000000.0); // Equation 15
 	_acceleration = acceleration;
-	computeNewSpeed();
+	updateSCurve();
+	updateRamp();
     }
     return _c0;
 }
 
-void AccelStepper::setAcceleration(float acceleration, float c0)
+void AccelStepper::setAcceleration(float acceleration, ramp_t c0)
 {
     if (acceleration == 0.0){
 	    return;
     }if (acceleration < 0.0){
       acceleration = -acceleration;
-    }if (_acceleration != acceleration)
+    }
+    invalidatePlan();
+    _baseAcceleration = acceleration;
+    if (_profileScale != 1.0){
+	// the shared c0 is only valid for unscaled steppers
+	applyAcceleration(acceleration * _profileScale);
+	return;
+    }
+    if (_acceleration != acceleration)
     {
 	// Recompute _n per Equation 17
 	_n = _n * (_acceleration / acceleration);
 	// New c0 per Equation 7, with correction per Equation 15
-	_c0 = c0; // Equation 15
+	_c0 = c0; // Equation 15, as computed by setAcceleration(float)
 	_acceleration = acceleration;
-	computeNewSpeed();
+	updateSCurve();
+	updateRamp();
+    }
+}
+
+long AccelStepper::stepsToStop()
+{
+    AccelStepPlan ramp;
+    savePlanState(ramp);
+    return stepsToStop(ramp);
+}
+
+long AccelStepper::stepsToStop(const AccelStepPlan &ramp)
+{
+#if !ACCELSTEPPER_FIXED_POINT
+    if (!holdsRampIndex())
+	return (long)((ramp.speed * ramp.speed) / (2.0 * _acceleration)); // Equation 16
+#endif
+    return labs(ramp.n); // Equation 16, |n| = speed^2 / (2 * acceleration), for the s-curve by symmetry of the ramp
+}
+
+bool AccelStepper::holdsRampIndex()
+{
+    return ACCELSTEPPER_FIXED_POINT || _profile == PROFILE_SCURVE;
+}
+
+void AccelStepper::setProfile(Profile profile)
+{
+    if (_profile != profile)
+    {
+	invalidatePlan();
+	_profile = profile;
+	updateSCurve();
+	// the ramp index is interpreted differently by the profiles, restart the ramp from the current speed
+	if (_n != 0 && !ACCELSTEPPER_FIXED_POINT)
+	    _n = (_n > 0) ? stepsToStop() : -stepsToStop();
+	updateRamp();
     }
 }
 
+void AccelStepper::setJerk(float jerk)
+{
+    if (jerk < 0.0)
+	jerk = -jerk;
+    if (jerk == 0.0)
+	return;
+    _baseJerk = jerk;
+    _jerk = jerk * _profileScale;
+    updateSCurve();
+}
+
+float AccelStepper::jerk()
+{
+    return _baseJerk;
+}
+
+void AccelStepper::updateSCurve()
+{
+    invalidatePlan();
+    float v = _maxSpeed;
+    float a = _acceleration;
+    float j = _jerk;
+
+    // Starting from rest, a move too short to reach max speed gets a ramp that peaks halfway through it.
+    // The acceleration is back to 0 there, instead of changing sign at once in the middle of the full ramp.
+    // A running stepper keeps its ramp, as the ramp index only maps to its speed on that ramp.
+    long distance = labs(distanceToGo());
+    if ((_n == 0 || _n == 1) && distance > 0)
+	v = min(v, sCurvePeakSpeed(distance / 2.0, a, j));
+
+    if (v * j >= a * a)
+    {
+	// reaches the max acceleration, with a constant acceleration phase in between
+	_sCurveAccel = a;
+	_sCurveT1 = a / j;
+	_sCurveT2 = v / a - a / j;
+    }
+    else
+    {
+	// max speed is reached before the acceleration gets to its max
+	_sCurveAccel = sqrt(v * j);
+	_sCurveT1 = _sCurveAccel / j;
+	_sCurveT2 = 0.0;
+    }
+    _sCurveV1 = _sCurveAccel * _sCurveT1 / 2.0;
+    _sCurveS1 = j * _sCurveT1 * _sCurveT1 * _sCurveT1 / 6.0;
+    _sCurveS2 = _sCurveS1 + _sCurveV1 * _sCurveT2 + _sCurveAccel * _sCurveT2 * _sCurveT2 / 2.0;
+    _sCurveRampTime = 2.0 * _sCurveT1 + _sCurveT2;
+    _sCurveRampSteps = v * _sCurveRampTime / 2.0; // the velocity is point symmetric around v/2
+    _sCurvePeak = v;
+    _sCurvePeakInterval = RAMP_FROM_FLOAT(1000000.0 / v);
+}
+
+float AccelStepper::sCurveRampDuration(float speed, float acceleration, float jerk)
+{
+    if (speed * jerk >= acceleration * acceleration)
+	return speed / acceleration + acceleration / jerk; // reaches the max acceleration
+    return 2.0 * sqrt(speed / jerk);
+}
+
+float AccelStepper::sCurvePeakSpeed(float steps, float acceleration, float jerk)
+{
+    // the ramp to v covers v * sCurveRampDuration(v) / 2 steps, solved for v
+    float a = acceleration;
+    float j = jerk;
+    if (steps <= a * a * a / (j * j))
+	return cbrt(steps * steps * j); // never reaches the max acceleration, steps = v * sqrt(v / j)
+    return (sqrt(a * a * a * a / (j * j) + 8.0 * a * steps) - a * a / j) / 2.0;
+}
+
+ramp_t AccelStepper::cruiseInterval()
+{
+    return (_profile == PROFILE_SCURVE) ? _sCurvePeakInterval : _cmin;
+}
+
+float AccelStepper::sCurveTime(float steps)
+{
+    if (steps <= _sCurveS1)
+	return cbrt(6.0 * steps / _jerk); // jerk up, s = j*t^3/6
+
+    if (steps <= _sCurveS2)
+    {
+	// constant acceleration, s = s1 + v1*t + a*t^2/2
+	return _sCurveT1 + (sqrt(_sCurveV1 * _sCurveV1 + 2.0 * _sCurveAccel * (steps - _sCurveS1)) - _sCurveV1) / _sCurveAccel;
+    }
+
+    // jerk down, solved for the time u before the end of the ramp, s = sRamp - v*u + j*u^3/6
+    // newton from below converges monotonically, the function is convex there
+    float u = (_sCurveRampSteps - steps) / _sCurvePeak;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+	float f = _sCurveRampSteps - _sCurvePeak * u + _jerk * u * u * u / 6.0 - steps;
+	float df = -_sCurvePeak + _jerk * u * u / 2.0;
+	if (df >= 0.0)
+	    break;
+	u -= f / df;
+    }
+    return _sCurveRampTime - u;
+}
+
+ramp_t AccelStepper::sCurveInterval(long n, ramp_t cmin)
+{
+    // Same indexing as the ramp table, decelerating at -n undoes the accelerating step n
+    long index = (n >= 0) ? n : -n - 1;
+    if (index + 1 > _sCurveRampSteps)
+	return cmin;
+    return RAMP_FROM_FLOAT((sCurveTime(index + 1) - sCurveTime(index)) * 1000000.0);
+}
+
 void AccelStepper::setSpeed(float speed)
 {
-    if (speed == _speed)
+    invalidatePlan();
+    if (speed == this->speed())
         return;
     speed = constrain(speed, -_maxSpeed, _maxSpeed);
     if (speed == 0.0)
@@ -399,14 +1024,32 @@ void AccelStepper::setSpeed(float speed)
 	_stepInterval = fabs(1000000.0 / speed);
 	_direction = (speed > 0.0) ? DIRECTION_CW : DIRECTION_CCW;
     }
+#if !ACCELSTEPPER_FIXED_POINT
     _speed = speed;
+#endif
 }
 
 float AccelStepper::speed()
 {
+#if ACCELSTEPPER_FIXED_POINT
+    // Not tracked per step in fixed point mode, derive it from the current step interval
+    if (!_stepInterval)
+	return 0.0;
+    float speed = 1000000.0 / _stepInterval;
+    return (_direction == DIRECTION_CW) ? speed : -speed;
+#else
     return _speed;
+#endif
 }
 
+#if ACCELSTEPPER_DRIVER_ONLY
+// bit 0 of the mask is the step pin, bit 1 the direction pin
+void AccelStepper::setOutputPins(uint8_t mask)
+{
+    digitalWrite(pin[0], (mask & 0b01) ? (HIGH ^ _pinInverted[0]) : (LOW ^ _pinInverted[0]));
+    digitalWrite(pin[1], (mask & 0b10) ? (HIGH ^ _pinInverted[1]) : (LOW ^ _pinInverted[1]));
+}
+#else
 // Subclasses can override
 void AccelStepper::step(long step)
 {
@@ -462,12 +1105,14 @@ void AccelStepper::setOutputPins(uint8_t mask)
 void AccelStepper::step0(long step)
 {
     (void)(step); // Unused
-    if (_speed > 0)
+    if (_direction == DIRECTION_CW)
 	_forward();
     else
 	_backward();
 }
 
+#endif
+
 // 1 pin step function (ie for stepper drivers)
 // This is passed the current step number (0 to 7)
 // Subclasses can override
@@ -478,6 +1123,12 @@ void AccelStepper::step1(long step)
     // pin[0] is step, pin[1] is direction
     setOutputPins(_direction ? 0b10 : 0b00); // Set direction first else get rogue pulses
     setOutputPins(_direction ? 0b11 : 0b01); // step HIGH
+    if (_twoPhasePulse)
+    {
+	// runSpeed() lowers the pin once the pulse width has passed
+	_stepPinHigh = true;
+	return;
+    }
     // Caution 200ns setup time 
     // Delay the minimum allowed pulse width
     delayMicroseconds(_minPulseWidth);
@@ -485,6 +1136,7 @@ void AccelStepper::step1(long step)
 }
 
 
+#if !ACCELSTEPPER_DRIVER_ONLY
 // 2 pin step function
 // This is passed the current step number (0 to 7)
 // Subclasses can override
@@ -630,11 +1282,14 @@ void AccelStepper::step8(long step)
             break;
     }
 }
+#endif
     
 // Prevents power consumption on the outputs
 void    AccelStepper::disableOutputs()
 {   
+#if !ACCELSTEPPER_DRIVER_ONLY
     if (! _interface) return;
+#endif
 
     setOutputPins(0); // Handles inversion automatically
     if (_enablePin != 0xff)
@@ -646,6 +1301,10 @@ void    AccelStepper::disableOutputs()
 
 void    AccelStepper::enableOutputs()
 {
+#if ACCELSTEPPER_DRIVER_ONLY
+    pinMode(pin[0], OUTPUT);
+    pinMode(pin[1], OUTPUT);
+#else
     if (! _interface) 
 	return;
 
@@ -660,6 +1319,7 @@ void    AccelStepper::enableOutputs()
     {
         pinMode(pin[2], OUTPUT);
     }
+#endif
 
     if (_enablePin != 0xff)
     {
@@ -673,6 +1333,11 @@ void AccelStepper::setMinPulseWidth(unsigned int minWidth)
     _minPulseWidth = minWidth;
 }
 
+void AccelStepper::setTwoPhasePulse(bool twoPhase)
+{
+    _twoPhasePulse = twoPhase;
+}
+
 void AccelStepper::setEnablePin(uint8_t enablePin)
 {
     _enablePin = enablePin;
@@ -728,10 +1393,10 @@ void AccelStepper::runToNewPosition(long position)
 
 void AccelStepper::stop()
 {
-    if (_speed != 0.0)
+    if (_stepInterval != 0)
     {    
-	long stepsToStop = (long)((_speed * _speed) / (2.0 * _acceleration)) + 1; // Equation 16 (+integer rounding)
-	if (_speed > 0)
+	long stepsToStop = this->stepsToStop() + 1; // Equation 16 (+integer rounding)
+	if (_direction == DIRECTION_CW)
 	    move(stepsToStop);
 	else
 	    move(-stepsToStop);
@@ -746,5 +1411,30 @@ void AccelStepper::setPinModesDriver()
 
 bool AccelStepper::isRunning()
 {
-    return !(_speed == 0.0 && _targetPos == _currentPos);
+    return !(_stepInterval == 0 && _targetPos == _currentPos);
+}
+
+bool AccelStepper::isScheduled()
+{
+    return _stepInterval || _stepPinHigh || ((isWiggling || _queueLength) && !isRunning());
+}
+
+unsigned long AccelStepper::nextRunTime(unsigned long now)
+{
+    if ((isWiggling || _queueLength) && !isRunning())
+	return now; // doWiggle() starts the next part of the wiggle, or run() the next queued move
+
+    // a step taken after now was sampled is not in the past
+    unsigned long elapsed = ((long)(now - _lastStepTime) > 0) ? now - _lastStepTime : 0;
+    unsigned long wait = 0xFFFFFFFF;
+    if (_stepInterval)
+	wait = (elapsed >= _stepInterval) ? 0 : _stepInterval - elapsed;
+    if (_stepPinHigh)
+    {
+	unsigned long pulseElapsed = ((long)(now - _stepPinHighTime) > 0) ? now - _stepPinHighTime : 0;
+	unsigned long pulseWait = (pulseElapsed >= _minPulseWidth) ? 0 : _minPulseWidth - pulseElapsed;
+	if (pulseWait < wait)
+	    wait = pulseWait;
+    }
+    return now + wait;
 }
@@ -276,6 +276,85 @@
  #define YIELD
 #endif
 
+// Compiles the library for DRIVER steppers only. step() calls step1() directly instead of switching over the
+// interface, and the 2, 3, 4 wire and functional step functions are left out.
+#ifndef ACCELSTEPPER_DRIVER_ONLY
+ #define ACCELSTEPPER_DRIVER_ONLY 0
+#endif
+
+// Selects the integer implementation of the ramp recurrence (Equation 13) instead of float.
+// Intended for MCUs without FPU, where every step otherwise pays for a software float division.
+#ifndef ACCELSTEPPER_FIXED_POINT
+ #define ACCELSTEPPER_FIXED_POINT 0
+#endif
+
+#if ACCELSTEPPER_FIXED_POINT
+// Step intervals as Q24.8 fixed point microseconds
+typedef int32_t ramp_t;
+ #define RAMP_FRACTION_BITS 8
+ #define RAMP_FROM_FLOAT(us) ((ramp_t)((us) * (float)(1L << RAMP_FRACTION_BITS)))
+ #define RAMP_TO_FLOAT(r)    ((float)(r) / (float)(1L << RAMP_FRACTION_BITS))
+ #define RAMP_TO_US(r)       ((unsigned long)((r) >> RAMP_FRACTION_BITS))
+#else
+// Step intervals as float microseconds
+typedef float ramp_t;
+ #define RAMP_FROM_FLOAT(us) ((ramp_t)(us))
+ #define RAMP_TO_FLOAT(r)    ((float)(r))
+ #define RAMP_TO_US(r)       ((unsigned long)(r))
+#endif
+
+// Number of ramp steps with a precomputed interval ratio, steps beyond that fall back to Equation 13.
+// The ratios are one table in flash shared by all steppers and accelerations, 0 disables it
+#ifndef ACCELSTEPPER_RAMP_TABLE_LENGTH
+ #define ACCELSTEPPER_RAMP_TABLE_LENGTH 512
+#endif
+
+// Number of moves queueMoveTo() can hold per stepper
+#ifndef ACCELSTEPPER_QUEUE_LENGTH
+ #define ACCELSTEPPER_QUEUE_LENGTH 4
+#endif
+
+// Number of steps planSteps() precomputes ahead of the motor, 0 disables planning
+#ifndef ACCELSTEPPER_PLAN_LENGTH
+ #define ACCELSTEPPER_PLAN_LENGTH 8
+#endif
+
+/// \brief Ramp state after one precomputed step, as computeNewSpeed() leaves it
+typedef struct
+{
+    unsigned long step;      ///< _stepCount after the step
+    long          position;  ///< Position after the step
+    long          n;
+    ramp_t        cn;
+    unsigned long interval;
+#if !ACCELSTEPPER_FIXED_POINT
+    float         speed;
+#endif
+    bool          direction;
+    uint8_t       version;   ///< _planVersion the step was planned for
+} AccelStepPlan;
+
+/////////////////////////////////////////////////////////////////////
+/// \class AccelRampTable AccelStepper.h <AccelStepper.h>
+/// \brief Precomputed step intervals of an acceleration ramp, relative to its initial step interval
+///
+/// Equation 13 makes every interval of the ramp the initial step interval c0 times a ratio that only depends
+/// on the ramp index, c_n = c0 * R_n with R_0 = 1 and R_n = R_(n-1) * (4n - 1) / (4n + 1).
+/// The ratios are computed at compile time into a single table in flash, which serves all steppers and
+/// accelerations and turns the per step division of Equation 13 into a multiplication.
+class AccelRampTable
+{
+public:
+    /// \return true if the step interval for this ramp index is precomputed
+    /// \param[in] n The ramp index, positive while accelerating, negative while decelerating
+    static bool   contains(long n);
+
+    /// \return The step interval for ramp index n, as Equation 13 would compute it from c0
+    /// \param[in] c0 The initial step interval, as computed by AccelStepper::setAcceleration()
+    /// \param[in] n The ramp index, positive while accelerating, negative while decelerating
+    static ramp_t interval(ramp_t c0, long n);
+};
+
 /////////////////////////////////////////////////////////////////////
 /// \class AccelStepper AccelStepper.h <AccelStepper.h>
 /// \brief Support for stepper motors with acceleration etc.
@@ -339,6 +418,13 @@ public:
 	HALF4WIRE = 8  ///< 4 wire half stepper, 4 motor pins required
     } MotorInterfaceType;
 
+    /// \brief Velocity profile of the moves
+    typedef enum
+    {
+	PROFILE_TRAPEZOIDAL = 0, ///< Constant acceleration, per Equation 13
+	PROFILE_SCURVE      = 1  ///< Jerk limited, the acceleration ramps up and down with the set jerk
+    } Profile;
+
     /// Constructor. You can have multiple simultaneous steppers, all moving
     /// at different speeds and accelerations, provided you call their run()
     /// functions at frequent enough intervals. Current Position is set to 0, target
@@ -398,6 +484,54 @@ public:
     /// 1 is cw, -1 is ccw
     void    moveToMinSteps(long absolute, int8_t dir, uint16_t min_steps);
 
+    /// the relative movement moveToSingleRevolution() would make, without moving
+    long    distanceToSingleRevolution(long absolute, int8_t dir);
+
+    /// the relative movement moveToExtraRevolutions() would make, without moving
+    long    distanceToExtraRevolutions(long absolute, int8_t dir, uint8_t extra_revs);
+
+    /// moves a relative distance with max speed and acceleration scaled by the given factor,
+    /// used to make several steppers start and arrive together. The scale stays in effect until
+    /// the next moveTo(), so speed and acceleration set in between are scaled as well
+    /// \param[in] relative The distance to move
+    /// \param[in] scale Factor applied to max speed and acceleration, > 0
+    void    moveScaled(long relative, float scale);
+
+    /// moves like moveToExtraRevolutions(), or moveToSingleRevolution() without extra revs, but derives
+    /// max speed and acceleration from the desired duration of the move, see moveScaled()
+    /// the duration is only met if the stepper is at standstill and the scale is within the limits
+    /// \param[in] duration Desired duration of the move in seconds
+    void    moveToDuration(long absolute, int8_t dir, uint8_t extra_revs, float duration);
+
+    /// queues a move that starts once the moves before it are done. The position is reached from where the previous
+    /// move ends, like moveToExtraRevolutions(), or like moveToSingleRevolution() without extra revs.
+    /// Consecutive moves in the same direction are joined into one, so the stepper runs through their junctions
+    /// at speed and only stops where the direction reverses. A move started from the queue uses the unscaled profile,
+    /// a move joined to the running one keeps its profile. Any other move clears the queue, and a running wiggle ends
+    /// after its current part.
+    /// \return false if the queue is full and the move was dropped
+    bool    queueMoveTo(long absolute, int8_t dir, uint8_t extra_revs);
+
+    /// \return The number of queued moves that have not started yet
+    uint8_t queuedMoves();
+
+    /// The time in seconds the stepper needs from its current speed to the target with the current max speed and
+    /// acceleration, including stopping and coming back if it moves away from the target or is too fast to stop in time.
+    /// The s-curve is estimated with the trapezoidal profile.
+    float   timeToTarget();
+
+    /// Limits the max speed and acceleration moveScaled() may scale to
+    void    setScaleLimits(float minSpeed, float maxSpeed, float minAcceleration, float maxAcceleration);
+
+    /// Time in seconds a move over the given distance takes from standstill,
+    /// with the configured (unscaled) max speed, acceleration and profile
+    float   moveDuration(long distance);
+
+    /// The factor moveScaled() needs so a move over the given distance takes duration seconds from standstill
+    /// Scaling max speed and acceleration (and jerk) by k keeps the shape of the profile,
+    /// moves reaching max speed take d/(k*v) + rampTime, triangular ones 2*sqrt(d/(k*a))
+    float   profileScaleForDuration(long distance, float duration);
+
     /// moves a distance and direction, when this new pos is reached it returns to origianl position
 /// if another movement is received during a wiggle set is wiggling is set to false 
     /// if another movement is received during a wiggle set is wiggling is set to false
@@ -424,12 +558,23 @@ public:
     /// \return true if the motor is still running to the target position.
     bool run();
 
+    /// Same as run(), but with the current time passed in, so that steppers that are run together
+    /// share one time sample and micros() is only read once.
+    /// \param[in] now The current time in microseconds, as returned by micros()
+    /// \return true if the motor is still running to the target position.
+    bool run(unsigned long now);
+
     /// Poll the motor and step it if a step is due, implementing a constant
     /// speed as set by the most recent call to setSpeed(). You must call this as
     /// frequently as possible, but at least once per step interval,
     /// \return true if the motor was stepped.
     bool runSpeed();
 
+    /// Same as runSpeed(), with the current time passed in like run(unsigned long now)
+    /// \param[in] now The current time in microseconds, as returned by micros()
+    /// \return true if the motor was stepped.
+    bool runSpeed(unsigned long now);
+
     /// Sets the maximum permitted speed. The run() function will accelerate
     /// up to the speed set by this function.
     /// Caution: the maximum speed achievable depends on your processor and clock speed.
@@ -444,15 +589,38 @@ public:
     /// \return The currently configured maximum speed
     float   maxSpeed();
 
+    /// Returns the acceleration configured for this stepper
+    /// that was previously set by setAcceleration();
+    float   acceleration();
+
+    /// Selects the velocity profile used by all following moves, all moveTo*() functions work with both.
+    /// The s-curve ramps the acceleration up and down with the jerk set by setJerk(), which avoids the
+    /// mechanical shock of the trapezoid's instant acceleration changes. The ramp is point symmetric,
+    /// so decelerating runs it backwards and the number of steps needed to stop stays the ramp index.
+    /// A move from standstill too short to reach max speed gets a ramp with a lower peak speed, which it
+    /// reaches halfway with the acceleration back at 0. A move retargeted while running keeps its ramp.
+    /// The s-curve evaluates the ramp in float on every step, it is more expensive than the trapezoid.
+    /// \param[in] profile The profile to use
+    void    setProfile(Profile profile);
+
+    /// Sets the jerk of the s-curve profile
+    /// \param[in] jerk The desired jerk in steps per second per second per second. Must be > 0.0
+    void    setJerk(float jerk);
+
+    /// Returns the jerk configured for this stepper
+    float   jerk();
+
     /// Sets the acceleration/deceleration rate.
     /// \param[in] acceleration The desired acceleration in steps per second
     /// per second. Must be > 0.0. This is an expensive call since it requires a square 
     /// root to be calculated. Dont call more ofthen than needed
-    float    setAcceleration(float acceleration);
+    /// \return The initial step interval c0, to pass on to the other steppers getting the same acceleration
+    ramp_t   setAcceleration(float acceleration);
 
     /// SetAcceleration but can take precalculated c0 avoiding taking Square Root, 
     /// faster when setting same accel for multiple steppers
-    void    setAcceleration(float acceleration, float c0);
+    /// \param[in] c0 As returned by setAcceleration(float), passed on as is so every stepper gets the same ramp
+    void    setAcceleration(float acceleration, ramp_t c0);
 
     /// Sets the desired constant speed for use with runSpeed().
     /// \param[in] speed The desired constant speed in steps per
@@ -531,6 +699,12 @@ public:
     /// \param[in] minWidth The minimum pulse width in microseconds. 
     void    setMinPulseWidth(unsigned int minWidth);
 
+    /// Selects the two phase step pulse for DRIVER. Instead of blocking for minPulseWidth in step1(),
+    /// the step pin is raised in one call to runSpeed() and lowered by the first call after
+    /// minPulseWidth has passed, so no CPU time is spent waiting.
+    /// \param[in] twoPhase true to enable the two phase pulse
+    void    setTwoPhasePulse(bool twoPhase);
+
     /// Sets the enable pin number for stepper drivers.
     /// 0xFF indicates unused (default).
     /// Otherwise, if a pin is set, the pin will be turned on when 
@@ -558,6 +732,24 @@ public:
     /// \return true if the speed is not zero or not at the target position
     bool    isRunning();
 
+    /// Precomputes the ramp of the upcoming steps of the current move, up to ACCELSTEPPER_PLAN_LENGTH ahead.
+    /// Meant to be called from the non time critical part of the program while run() is called from an
+    /// interrupt: run() then takes the state after each step from the plan instead of calling computeNewSpeed().
+    /// Any change of target, speed, acceleration or position invalidates the plan, and run() falls back
+    /// to computing the ramp itself until the plan has caught up again.
+    /// \return The number of planned steps that are buffered
+    uint8_t planSteps();
+
+    /// Checks if run() has anything to do in the future, a step, finishing a pulse or the next part of a wiggle
+    /// \return false if the stepper is at rest and run() can be skipped until the next command
+    bool    isScheduled();
+
+    /// The time at which run() has something to do next, only meaningful if isScheduled()
+    /// Lets a scheduler skip calling run() for steppers that are not due
+    /// \param[in] now The current time in microseconds
+    /// \return The time in microseconds, now if something is due already
+    unsigned long nextRunTime(unsigned long now);
+
     /// Arduino pin number assignments for the 2 or 4 pins required to interface to the
     /// stepper motor or driver
     uint8_t        pin[4];
@@ -603,19 +795,29 @@ protected:
     /// bit 1 of the mask corresponds to _pin[1]
     /// You can override this to impment, for example serial chip output insted of using the
     /// output pins directly
+    /// With ACCELSTEPPER_DRIVER_ONLY it only writes the step and direction pin and can not be overridden.
+#if ACCELSTEPPER_DRIVER_ONLY
+    void           setOutputPins(uint8_t mask);
+#else
     virtual void   setOutputPins(uint8_t mask);
+#endif
 
     /// Called to execute a step. Only called when a new step is
     /// required. Subclasses may override to implement new stepping
     /// interfaces. The default calls step1(), step2(), step4() or step8() depending on the
     /// number of pins defined for the stepper.
+    /// With ACCELSTEPPER_DRIVER_ONLY it always calls step1(), which is the one to override then.
     /// \param[in] step The current step phase number (0 to 7)
+#if ACCELSTEPPER_DRIVER_ONLY
+    void           step(long step) { step1(step); }
+#else
     virtual void   step(long step);
 
     /// Called to execute a step using stepper functions (pins = 0) Only called when a new step is
     /// required. Calls _forward() or _backward() to perform the step
     /// \param[in] step The current step phase number (0 to 7)
     virtual void   step0(long step);
+#endif
 
     /// Called to execute a step on a stepper driver (ie where pins == 1). Only called when a new step is
     /// required. Subclasses may override to implement new stepping
@@ -625,6 +827,7 @@ protected:
     /// \param[in] step The current step phase number (0 to 7)
     virtual void   step1(long step);
 
+#if !ACCELSTEPPER_DRIVER_ONLY
     /// Called to execute a step on a 2 pin motor. Only called when a new step is
     /// required. Subclasses may override to implement new stepping
     /// interfaces. The default sets or clears the outputs of pin1 and pin2
@@ -658,15 +861,18 @@ protected:
     /// pin3, pin4.
     /// \param[in] step The current step phase number (0 to 7)
     virtual void   step8(long step);
+#endif
 
     /// Current direction motor is spinning in
     /// Protected because some peoples subclasses need it to be so
     bool _direction; // 1 == CW
     
 private:
+#if !ACCELSTEPPER_DRIVER_ONLY
     /// Number of pins on the stepper motor. Permits 2 or 4. 2 pins is a
     /// bipolar, and 4 pins is a unipolar.
     uint8_t        _interface;          // 0, 1, 2, 4, 8, See MotorInterfaceType
+#endif
 
     /// Whether the _pins is inverted or not
     uint8_t        _pinInverted[4];
@@ -685,9 +891,12 @@ private:
     /// The relative movement of most recent wiggle
     long           _wiggleRelative;     // Steps
 
+#if !ACCELSTEPPER_FIXED_POINT
     /// The current motos speed in steps per second
     /// Positive is clockwise
+    /// Not tracked in fixed point mode, speed() derives it from _stepInterval instead
     float          _speed;         // Steps per second
+#endif
 
     /// The maximum permitted speed in steps per second. Must be > 0.
     float          _maxSpeed;
@@ -695,18 +904,63 @@ private:
     /// The acceleration to use to accelerate or decelerate the motor in steps
     /// per second per second. Must be > 0
     float          _acceleration;
+
+    /// Max speed and acceleration as set by the user, _maxSpeed and _acceleration are these times _profileScale
+    float          _baseMaxSpeed;
+    float          _baseAcceleration;
+
+    /// Factor on max speed and acceleration for the current move, see moveScaled()
+    float          _profileScale;
+
+    /// Limits of the scaled max speed and acceleration, see setScaleLimits()
+    float          _minScaledSpeed;
+    float          _maxScaledSpeed;
+    float          _minScaledAcceleration;
+    float          _maxScaledAcceleration;
+
+    /// Velocity profile, see setProfile()
+    Profile        _profile;
+
+    /// Jerk of the s-curve in steps per second^3, _jerk is _baseJerk times _profileScale
+    float          _jerk;
+    float          _baseJerk;
+
+    /// The s-curve ramp from standstill to _maxSpeed, precomputed by updateSCurve()
+    /// T1 is the duration of the jerk phases, T2 of the constant acceleration phase in between,
+    /// V1 and S1 are speed and distance at the end of the first jerk phase, S2 at the end of the constant acceleration
+    float          _sCurveAccel;
+    float          _sCurveT1;
+    float          _sCurveT2;
+    float          _sCurveV1;
+    float          _sCurveS1;
+    float          _sCurveS2;
+    float          _sCurveRampTime;
+    float          _sCurveRampSteps;
+    /// Peak speed of the ramp, below _maxSpeed for short moves, and the interval at it
+    float          _sCurvePeak;
+    ramp_t         _sCurvePeakInterval;
     float          _sqrt_twoa; // Precomputed sqrt(2*_acceleration)
 
     /// The current interval between steps in microseconds.
-    /// 0 means the motor is currently stopped with _speed == 0
+    /// 0 means the motor is currently stopped
     unsigned long  _stepInterval;
 
     /// The last step time in microseconds
+    /// This is the time the step was due, which can be a little earlier than the time it was taken
     unsigned long  _lastStepTime;
 
+    /// The time the step pin was raised in microseconds, for the two phase pulse
+    unsigned long  _stepPinHighTime;
+
     /// The minimum allowed pulse width in microseconds
     unsigned int   _minPulseWidth;
 
+    /// Is the two phase step pulse enabled?
+    bool           _twoPhasePulse;
+
+    /// Is the step pin still high from the last step, only used with the two phase pulse
+    bool           _stepPinHigh;
+
     /// Is the direction pin inverted?
     ///bool           _dirInverted; /// Moved to _pinInverted[1]
 
@@ -719,23 +973,110 @@ private:
     /// Enable pin for stepper driver, or 0xFF if unused.
     uint8_t        _enablePin;
 
+#if !ACCELSTEPPER_DRIVER_ONLY
     /// The pointer to a forward-step procedure
     void (*_forward)();
 
     /// The pointer to a backward-step procedure
     void (*_backward)();
+#endif
 
     /// The step counter for speed calculations
+    /// In fixed point mode and with the s-curve it is held while cruising at max speed, so that |_n| is
+    /// always the number of steps needed to stop (Equation 16)
     long _n;
 
     /// Initial step size in microseconds
-    float _c0;
+    ramp_t _c0;
 
     /// Last step size in microseconds
-    float _cn;
+    ramp_t _cn;
 
     /// Min step size in microseconds based on maxSpeed
-    float _cmin; // at max speed
+    ramp_t _cmin; // at max speed
+
+#if ACCELSTEPPER_PLAN_LENGTH
+    /// Ring of planned steps, filled by planSteps() at _planTail and taken by run() at _planHead
+    AccelStepPlan  _plan[ACCELSTEPPER_PLAN_LENGTH];
+    volatile uint8_t _planHead;
+    volatile uint8_t _planTail;
+
+    /// The last planned step, planSteps() continues from there
+    AccelStepPlan  _planLast;
+#endif
+
+    /// Incremented whenever the plan gets outdated
+    volatile uint8_t _planVersion;
+
+    /// Number of steps taken, identifies planned steps
+    unsigned long  _stepCount;
+
+    /// Sets the target without resetting the profile scale
+    void           setTarget(long absolute);
+
+    /// Brings the ramp up to date after a change of target, speed or acceleration. Computes the first step when the
+    /// stepper is at rest, a running stepper only changes its ramp with its next step so the speed stays continuous.
+    void           updateRamp();
+
+    /// Time of a trapezoidal move over distance, starting at speed towards the target and ending at rest
+    float          rampTime(float distance, float speed);
+
+    /// The relative movements of distanceToSingleRevolution() and distanceToExtraRevolutions() from a normalized position
+    long           singleRevolutionDistance(long from, long absolute, int8_t dir);
+    long           extraRevolutionsDistance(long from, long absolute, int8_t dir, uint8_t extra_revs);
+
+    /// Relative distances of the queued moves, the first one at _queueHead
+    long           _queue[ACCELSTEPPER_QUEUE_LENGTH];
+    uint8_t        _queueHead;
+    uint8_t        _queueLength;
+
+    /// Starts the next queued move, joined with all following moves in the same direction
+    void           startQueuedMove();
+
+    /// Applies the planned state for the step just taken, returns false if there is none
+    bool           takePlannedStep();
+
+    /// Marks all planned steps as outdated
+    void           invalidatePlan();
+
+    /// Copies the ramp state into or out of a planned step
+    void           savePlanState(AccelStepPlan &plan);
+    void           loadPlanState(const AccelStepPlan &plan);
+
+    /// computeNewSpeed() on a copy of the ramp state, so planSteps() can work ahead without touching the stepper
+    void           computeNewSpeed(AccelStepPlan &ramp, long target, ramp_t c0, ramp_t cmin);
+
+    /// Sets the scaled max speed and acceleration
+    void           applyMaxSpeed(float speed);
+    ramp_t         applyAcceleration(float acceleration);
+    void           setProfileScale(float scale);
+
+    /// Number of steps needed to stop from the current speed (Equation 16)
+    long           stepsToStop();
+    long           stepsToStop(const AccelStepPlan &ramp);
+
+    /// true if |_n| is kept as the number of steps needed to stop, see _n
+    bool           holdsRampIndex();
+
+    /// Duration of a ramp from standstill to the unscaled max speed
+    float          rampDuration();
+
+    void           updateSCurve();
+
+    /// Duration of an s-curve ramp from standstill to speed
+    float          sCurveRampDuration(float speed, float acceleration, float jerk);
+
+    /// Peak speed of the s-curve ramp that covers the given number of steps
+    float          sCurvePeakSpeed(float steps, float acceleration, float jerk);
+
+    /// Interval at the top of the ramp, cmin or the peak interval of the s-curve
+    ramp_t         cruiseInterval();
+
+    /// Time along the s-curve ramp until the given number of steps is done
+    float          sCurveTime(float steps);
+
+    /// Step interval for ramp index n on the s-curve ramp, cmin once it reaches the max speed
+    ramp_t         sCurveInterval(long n, ramp_t cmin);
 
 };
 
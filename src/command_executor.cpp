@@ -0,0 +1,89 @@
+#include <Arduino.h>
+#include "config.h"
+#include "command_executor.h"
+#include "packet_handlers.h"
+#include "step_engine.h"
+
+uint16_t drain_budget_us = COMMAND_DRAIN_BUDGET_US;
+CommandDrainStats drain_stats;
+
+void executeCommand(CommandData &command_data)
+{
+    // look up the handler of the command id, then check the length, the checksum and if the values are valid
+    // only the steppers the command changes are locked while it executes, all others keep stepping meanwhile
+    const CommandEntry *command = parseCommand(command_data.buffer, command_data.bufferLength);
+    if (command)
+    {
+        stepEngineLock(command->select(command_data.buffer, command_data.bufferLength));
+        command->execute(command_data.buffer, command_data.bufferLength);
+        stepEngineUnlock();
+    }
+#if DEBUG
+    else
+        Serial.println("Invalid command received, this can happen here due to interference, ignoring command");
+#endif
+}
+
+void executeQueuedCommands(CommandQueue &queue)
+{
+    unsigned long start = micros();
+    unsigned long budget = min((unsigned long)drain_budget_us, stepEngineTimeUntilPoll());
+
+    uint16_t executed = 0;
+    CommandData *next_cmd_data;
+    while ((next_cmd_data = queue.peekCommand()) != nullptr)
+    {
+        if (executed > 0 && micros() - start >= budget)
+        {
+            drain_stats.budget_exhausted++;
+            break;
+        }
+        // the command is read from its queue slot, so the slot is only freed once the command is done
+        executeCommand(*next_cmd_data);
+        queue.popCommand();
+        executed++;
+    }
+
+    if (executed == 0)
+        return;
+    drain_stats.commands += executed;
+    drain_stats.passes++;
+    drain_stats.max_per_pass = max(drain_stats.max_per_pass, executed);
+
+#if DEBUG
+    static unsigned long stats_start = 0;
+    if (millis() - stats_start >= COMMAND_DRAIN_STATS_INTERVAL_MS)
+    {
+        Serial.print("commands executed: ");
+        Serial.print(drain_stats.commands);
+        Serial.print(" in passes: ");
+        Serial.print(drain_stats.passes);
+        Serial.print(" max per pass: ");
+        Serial.print(drain_stats.max_per_pass);
+        Serial.print(" budget exhausted: ");
+        Serial.println(drain_stats.budget_exhausted);
+        resetCommandDrainStats();
+        stats_start = millis();
+    }
+#endif
+}
+
+void setCommandDrainBudget(uint16_t budget_us)
+{
+    drain_budget_us = budget_us;
+}
+
+uint16_t commandDrainBudget()
+{
+    return drain_budget_us;
+}
+
+CommandDrainStats commandDrainStats()
+{
+    return drain_stats;
+}
+
+void resetCommandDrainStats()
+{
+    drain_stats = CommandDrainStats();
+}
@@ -2,51 +2,39 @@
 #include "config.h"
 #include "command_queue.h"
 
-bool CommandQueue::pushCommand(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength){
-    commands[current_push_index].bufferLength = bufferLength;
-    memcpy(commands[current_push_index].buffer, buffer, bufferLength);
-    commands[current_push_index].commandID = static_cast<uint8_t>(commands[current_push_index].buffer[0]);
-    
-    if(!commands[current_push_index].hasExecuted){
-        //if the command at the current_push_index has not been executed yet, push the execute index forward 
-        //this keeps the queue fifo but allows overwriting of commands that have not been executed yet
-        //if the queue is full
-        current_execute_index = (current_execute_index + 1) % CMD_QUEUE_LENGTH; 
+#define CMD_QUEUE_MASK (CMD_QUEUE_LENGTH - 1)
 
-        current_push_index = (current_push_index + 1) % CMD_QUEUE_LENGTH;
-
-        return true;
+CommandData *CommandQueue::reserveCommand(uint8_t offset){
+    uint16_t slot = tail + offset;
+    if((uint16_t)(slot - head) >= CMD_QUEUE_LENGTH){
+        //the consumer owns the slot, overwriting it could change a command while it is being executed
+        return nullptr;
     }
-    else{
-        commands[current_push_index].hasExecuted = false;
-
-        current_push_index = (current_push_index + 1) % CMD_QUEUE_LENGTH;
+    return &commands[slot & CMD_QUEUE_MASK];
+}
 
-        return false;
-    }
+void CommandQueue::commitCommands(uint8_t count){
+    //the commands have to be complete before the consumer can see them
+    __sync_synchronize();
+    tail = tail + count;
 }
 
 bool CommandQueue::isEmpty(){
-    return commands[current_execute_index].hasExecuted;
+    return head == tail;
 }
 
-const CommandData& CommandQueue::popCommand(){
-    if(!isEmpty()){
-        commands[current_execute_index].hasExecuted = true;
-
-        uint16_t temp = current_execute_index;
-        current_execute_index = (current_execute_index + 1) % CMD_QUEUE_LENGTH;
-
-        return commands[temp];
+CommandData *CommandQueue::peekCommand(){
+    uint16_t current_head = head;
+    if(current_head == tail){
+        return nullptr;
     }
-#if DEBUG
-    Serial.println("Command queue is empty");
-    Serial.println("Returning invalid command");
-    //print push and execute index
-    Serial.print("Push index: ");
-    Serial.println(current_push_index);
-    Serial.print("Execute index: ");
-    Serial.println(current_execute_index);
-#endif
-    return invalid_command;
+    //reading the tail above has to happen before reading the slot it published
+    __sync_synchronize();
+    return &commands[current_head & CMD_QUEUE_MASK];
+}
+
+void CommandQueue::popCommand(){
+    //everything read from the slot has to be done before the producer can reuse it
+    __sync_synchronize();
+    head = head + 1;
 }
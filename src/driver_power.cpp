@@ -0,0 +1,61 @@
+#include <Arduino.h>
+#include "config.h"
+#include "driver_power.h"
+#include "step_engine.h"
+
+driver_power_mode current_driver_mode;
+uint16_t idle_hold_time_ms;
+bool drivers_enabled;
+unsigned long last_busy_time;
+
+void setDriversEnabled(bool enabled)
+{
+    digitalWrite(ENABLE_PIN, enabled);
+    drivers_enabled = enabled;
+}
+
+void initializeDriverPower()
+{
+    // enabled right away so no weird behaviour happens during mcu startup (has external pull down)
+    pinMode(ENABLE_PIN, OUTPUT);
+    setDriversEnabled(true);
+    current_driver_mode = DRIVER_DEFAULT_MODE;
+    idle_hold_time_ms = DRIVER_IDLE_HOLD_MS;
+    last_busy_time = millis();
+}
+
+void setDriverMode(driver_power_mode mode)
+{
+    current_driver_mode = mode;
+    if (mode != driver_auto)
+        setDriversEnabled(mode == driver_on);
+    else if (!stepEngineIdle())
+        setDriversEnabled(true);
+    // the hold time starts over when switching to auto
+    last_busy_time = millis();
+}
+
+void setDriverIdleHoldTime(uint16_t hold_time_ms)
+{
+    idle_hold_time_ms = hold_time_ms;
+}
+
+void driverPowerOnCommand()
+{
+    if (stepEngineIdle())
+        return;
+    last_busy_time = millis();
+    if (current_driver_mode == driver_auto && !drivers_enabled)
+        setDriversEnabled(true);
+}
+
+void updateDriverPower()
+{
+    if (current_driver_mode != driver_auto || !drivers_enabled)
+        return;
+
+    if (!stepEngineIdle())
+        last_busy_time = millis();
+    else if (millis() - last_busy_time >= idle_hold_time_ms)
+        setDriversEnabled(false);
+}
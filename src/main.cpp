@@ -4,12 +4,22 @@
 #include "steppers.h"
 #include "packet_handlers.h"
 #include "command_queue.h"
+#include "step_engine.h"
+#include "driver_power.h"
+#include "command_executor.h"
 
 // i2c handlers
 void i2c_receive(int numBytesReceived);
+void i2c_receive_batch(int numBytesReceived);
 void i2c_request();
 
+#if LOW_POWER_IDLE && STEP_ENGINE_USE_TIMER
+void sleepUntilInterrupt();
+#endif
+
 CommandQueue i2c_cmd_queue;
+// commands and batch frames dropped because the queue was full, counted in the i2c interrupt and reported by the loop
+volatile uint16_t command_queue_overflows = 0;
 
 #pragma region setup and loop
 
@@ -19,9 +29,7 @@ void setup()
     delay(5);
     initializeSteppers();
     
-    // set enable_pin to high so no weird behaviour happens during mcu startup (has external pull down)
-    pinMode(ENABLE_PIN, OUTPUT);
-    digitalWrite(ENABLE_PIN, HIGH);
+    initializeDriverPower();
 
     // Initialize as i2c slave
     Wire.setSCL(I2C_SCL_PIN);
@@ -30,6 +38,9 @@ void setup()
     Wire.onReceive(i2c_receive);
     Wire.onRequest(i2c_request);
 
+    // start generating steps, from here on stepper state may only be changed while the step engine is locked
+    initializeStepEngine();
+
 #if DEBUG
     Serial.begin(9600);
     Serial.println("Setup done");
@@ -39,88 +50,59 @@ void setup()
 // the loop function runs over and over again forever
 void loop()
 {
-    if (!i2c_cmd_queue.isEmpty())
+#if DEBUG
+    if (command_queue_overflows)
     {
-        CommandData next_cmd_data = i2c_cmd_queue.popCommand();
+        Serial.print("command queue full, dropped commands: ");
+        Serial.println(command_queue_overflows);
+        command_queue_overflows = 0;
+    }
+#endif
 
-#if DEBUG
-        if (!next_cmd_data.hasExecuted)
-        {
-            Serial.println("invalid command packet, this shouldnt happen here");
-            return;
-        }
+    executeQueuedCommands(i2c_cmd_queue);
+
+    stepEnginePoll();
+    updateDriverPower();
+
+#if LOW_POWER_IDLE && STEP_ENGINE_USE_TIMER
+    sleepUntilInterrupt();
 #endif
-        // call the correct packet handler for each command id, these parse the buffer, check the checksum, check if the command is valid and then execute the command
-        switch (next_cmd_data.commandID)
-        {
-        case enable_driver:
-        {
-            EnableDriverPacket packet(next_cmd_data.buffer, next_cmd_data.bufferLength);
-            packet.executeCommand();
-            break;
-        }
-        case set_speed:
-        {
-            SetSpeedPacket packet(next_cmd_data.buffer, next_cmd_data.bufferLength);
-            packet.executeCommand();
-            break;
-        }
-        case set_accel:
-        {
-            SetAccelPacket packet(next_cmd_data.buffer, next_cmd_data.bufferLength);
-            packet.executeCommand();
-            break;
-        }
-        case moveTo:
-        {
-            MoveToPacket packet(next_cmd_data.buffer, next_cmd_data.bufferLength);
-            packet.executeCommand();
-            break;
-        }
-        case moveTo_extra_revs:
-        {
-            MoveToExtraRevsPacket packet(next_cmd_data.buffer, next_cmd_data.bufferLength);
-            packet.executeCommand();
-            break;
-        }
-        case move:
-        {
-            MovePacket packet(next_cmd_data.buffer, next_cmd_data.bufferLength);
-            packet.executeCommand();
-            break;
-        }
-        case stop:
-        {
-            StopPacket packet(next_cmd_data.buffer, next_cmd_data.bufferLength);
-            packet.executeCommand();
-            break;
-        }
-        case wiggle:
-        {
-            WigglePacket packet(next_cmd_data.buffer, next_cmd_data.bufferLength);
-            packet.executeCommand();
-            break;
-        }
-        case moveTo_min_steps:
-        {
-            MoveToMinStepsPacket packet(next_cmd_data.buffer, next_cmd_data.bufferLength);
-            packet.executeCommand();
-            break;
-        }
+}
+
+#pragma endregion
 
-        default:
+#pragma region low power idle
+
+#if LOW_POWER_IDLE && STEP_ENGINE_USE_TIMER
+// sleeps until the next interrupt if there is no command left, with the steps generated by the timer there is nothing else to do
+void sleepUntilInterrupt()
+{
 #if DEBUG
-            Serial.println("Invalid command ID received, this can happen here due to interference, ignoring command");
+    static unsigned long stats_start = 0;
+    static unsigned long time_asleep = 0;
+    unsigned long sleep_start = micros();
 #endif
-            break;
-        }
-    }
 
-    for (int i = 0; i < NUM_STEPPERS; i++)
+    // a command pushed between the check and WFI still wakes the core, as pending interrupts end WFI even while they are disabled
+    noInterrupts();
+    if (i2c_cmd_queue.isEmpty())
+        __WFI();
+    interrupts();
+
+#if DEBUG
+    time_asleep += micros() - sleep_start;
+    if (millis() - stats_start >= IDLE_STATS_INTERVAL_MS)
     {
-        steppers[i]->run();
+        Serial.print("cpu awake % (steppers idle: ");
+        Serial.print(stepEngineIdle());
+        Serial.print("): ");
+        Serial.println(100 - time_asleep / (IDLE_STATS_INTERVAL_MS * 10));
+        stats_start = millis();
+        time_asleep = 0;
     }
+#endif
 }
+#endif
 
 #pragma endregion
 
@@ -128,33 +110,98 @@ void loop()
 
 void i2c_receive(int numBytesReceived)
 {
-    if (numBytesReceived >= 2 && numBytesReceived <= MAX_COMMAND_LENGTH)
+    if (numBytesReceived >= 2 && Wire.peek() == BATCH_FRAME_ID)
     {
-        byte i2c_buffer[MAX_COMMAND_LENGTH];
-        Wire.readBytes((byte *)&i2c_buffer, numBytesReceived);
-        i2c_cmd_queue.pushCommand(i2c_buffer, numBytesReceived);
+        i2c_receive_batch(numBytesReceived);
+        return;
     }
-    else
+
+    if (numBytesReceived >= 2 && numBytesReceived <= MAX_COMMAND_LENGTH)
     {
-        // clear the bytes form the buffer
-        byte discard_buffer[numBytesReceived];
-        Wire.readBytes((byte *)&discard_buffer, numBytesReceived);
+        // receive straight into the queue slot, the command is parsed from there later
+        CommandData *command = i2c_cmd_queue.reserveCommand();
+        if (command)
+        {
+            Wire.readBytes(command->buffer, numBytesReceived);
+            command->bufferLength = numBytesReceived;
+            i2c_cmd_queue.commitCommands();
+            return;
+        }
+        command_queue_overflows++;
+    }
 #if DEBUG
+    else
         Serial.println("Invalid command byte length");
 #endif
-    }
+
+    // clear the bytes form the buffer
+    while (Wire.available())
+        Wire.read();
 }
 
-void i2c_request()
+// splits a batch frame into the queue, the commands are only committed once the whole frame and its checksum are received
+// each command gets its checksum appended in its slot, so it is parsed the same way as a command received on its own
+void i2c_receive_batch(int numBytesReceived)
 {
-    byte is_running_bitmap = 0; // 1 if it's still running to target
+    uint8_t frame_checksum = Wire.read(); // the frame id
+    int remaining = numBytesReceived - 2; // without the frame id and the frame checksum
+    uint8_t num_commands = 0;
+    bool valid = true;
 
-    for (int i = 0; i < NUM_STEPPERS; i++)
+    while (remaining > 0)
     {
-        is_running_bitmap |= (steppers[i]->isRunning() << i);
+        uint8_t length = Wire.read();
+        remaining--;
+        if (length == 0 || length >= MAX_COMMAND_LENGTH || length > remaining)
+        {
+            valid = false;
+            break;
+        }
+
+        CommandData *command = i2c_cmd_queue.reserveCommand(num_commands);
+        if (!command)
+        {
+            command_queue_overflows++;
+            valid = false;
+            break;
+        }
+        Wire.readBytes(command->buffer, length);
+        remaining -= length;
+
+        uint8_t checksum = 0;
+        for (uint8_t i = 0; i < length; i++)
+        {
+            checksum += command->buffer[i];
+        }
+        command->buffer[length] = checksum;
+        command->bufferLength = length + 1;
+
+        frame_checksum += length + checksum;
+        num_commands++;
     }
 
+    if (valid && Wire.read() == frame_checksum)
+        i2c_cmd_queue.commitCommands(num_commands);
+#if DEBUG
+    else
+        Serial.println("Invalid batch frame");
+#endif
+
+    // clear the bytes form the buffer
+    while (Wire.available())
+        Wire.read();
+}
+
+void i2c_request()
+{
+    byte is_running_bitmap = stepper_bank.runningMask(); // 1 if it's still running to target
+
     Wire.write(is_running_bitmap);
+
+    // a master reading only one byte just gets the bitmap
+    byte reply[MAX_QUERY_REPLY_LENGTH];
+    uint8_t reply_length = queryReply(reply);
+    Wire.write(reply, reply_length);
 }
 
 #pragma endregion
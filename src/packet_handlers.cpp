@@ -3,6 +3,8 @@
 #include <AccelStepper.h>
 #include "config.h"
 #include "steppers.h"
+#include "driver_power.h"
+#include "command_executor.h"
 
 bool isStepperIDValid(int8_t stepper_id)
 {
@@ -14,20 +16,23 @@ bool isCommandIDValid(uint8_t command_id)
     return command_id >= CMD_ID_MIN && command_id <= CMD_ID_MAX;
 }
 
-#pragma region Abstract Packet Class
-
-CommandPacket::CommandPacket() {}
-
-// abstract class for packet data
-CommandPacket::CommandPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength)
+// returns the mask of the steppers a stepper id refers to
+uint8_t selectionMask(int8_t stepper_id)
 {
-    memcpy(this->buffer, buffer, bufferLength);
-    this->bufferLength = bufferLength;
-
-    valid = verifyChecksum();
+    switch (stepper_id)
+    {
+    case selector_all:
+        return STEPPER_MASK_ALL;
+    case selector_hour:
+        return STEPPER_MASK_H;
+    case selector_minute:
+        return STEPPER_MASK_M;
+    default: // all the other stepper ids selecting individual steppers
+        return 1 << stepper_id;
+    }
 }
 
-bool CommandPacket::verifyChecksum()
+bool verifyChecksum(const byte *buffer, uint8_t bufferLength)
 {
     uint8_t checksum = 0;
     for (int i = 0; i < bufferLength - 1; i++)
@@ -37,596 +42,576 @@ bool CommandPacket::verifyChecksum()
     return checksum == buffer[bufferLength - 1];
 }
 
-#pragma endregion
-
-#pragma region Enable Driver Packet
+// each command has a validate function checking the values of its packet and an execute function applying it to the selected steppers
+// the id, checksum, length and stepper selection are already checked by parseCommand() when they are called
 
-EnableDriverPacket::EnableDriverPacket() : CommandPacket() {}
+#pragma region Enable Driver
 
-EnableDriverPacket::EnableDriverPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength) : CommandPacket(buffer, bufferLength)
+static bool validateEnableDriver(const enable_driver_datastruct &)
 {
-    valid = parseData();
+    return true;
 }
 
-bool EnableDriverPacket::parseData()
+static void executeEnableDriver(const enable_driver_datastruct &data, uint8_t)
 {
-    if (valid)
-    {
-        if (!(bufferLength == sizeof(data)))
-            return false;
+    // overrides the automatic enable until set_driver_mode switches back to auto
+    setDriverMode(data.enable ? driver_on : driver_off);
+}
 
-        memcpy(&data, buffer, sizeof(data));
+#pragma endregion
 
-        if (data.cmd_id != commandID)
-            return false;
+#pragma region Set Driver Mode
 
-        return true;
-    }
-    return false;
+static bool validateSetDriverMode(const set_driver_mode_datastruct &data)
+{
+    return data.mode == driver_off || data.mode == driver_on || data.mode == driver_auto;
 }
 
-bool EnableDriverPacket::executeCommand()
+static void executeSetDriverMode(const set_driver_mode_datastruct &data, uint8_t)
 {
-    if (valid)
-    {
-        digitalWrite(ENABLE_PIN, data.enable);
-        return true;
-    }
-    return false;
+    setDriverIdleHoldTime(data.idle_hold_time);
+    setDriverMode((driver_power_mode)data.mode);
 }
 
 #pragma endregion
 
-#pragma region Set Speed Packet
-
-SetSpeedPacket::SetSpeedPacket() : CommandPacket() {}
+#pragma region Set Speed
 
-SetSpeedPacket::SetSpeedPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength) : CommandPacket(buffer, bufferLength)
+static bool validateSetSpeed(const set_speed_datastruct &data)
 {
-    valid = parseData();
+    if (data.speed < MIN_SPEED || data.speed > MAX_SPEED)
+        return false;
+    return true;
 }
 
-bool SetSpeedPacket::parseData()
+static void executeSetSpeed(const set_speed_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        if (!(bufferLength == sizeof(data)))
-            return false;
+        if (mask & (1 << i))
+            stepper_bank[i].setMaxSpeed(data.speed);
+    }
+}
 
-        memcpy(&data, buffer, sizeof(data));
+#pragma endregion
 
-        if (data.cmd_id != commandID)
-            return false;
-        if (data.speed < MIN_SPEED || data.speed > MAX_SPEED)
-            return false;
-        if (!isStepperIDValid(data.stepper_id))
-            return false;
+#pragma region Set Accel
 
-        return true;
-    }
-    return false;
+static bool validateSetAccel(const set_accel_datastruct &data)
+{
+    if (data.accel < MIN_ACCEL || data.accel > MAX_ACCEL)
+        return false;
+    return true;
 }
 
-bool SetSpeedPacket::executeCommand()
+static void executeSetAccel(const set_accel_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    // the first selected stepper computes the initial step interval, the others reuse it
+    ramp_t c0 = 0;
+    bool c0_computed = false;
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        switch (data.stepper_id)
+        if (!(mask & (1 << i)))
+            continue;
+        if (!c0_computed)
         {
-        case selector_all:
-            for (int i = 0; i < NUM_STEPPERS; i++)
-            {
-                steppers[i]->setMaxSpeed(data.speed);
-            }
-            break;
-
-        case selector_hour:
-            for (int i = 0; i < NUM_STEPPERS_H; i++)
-            {
-                h_steppers[i]->setMaxSpeed(data.speed);
-            }
-            break;
-
-        case selector_minute:
-            for (int i = 0; i < NUM_STEPPERS_M; i++)
-            {
-                m_steppers[i]->setMaxSpeed(data.speed);
-            }
-            break;
-
-        default: // all the other stepper ids selecting individual steppers
-            steppers[data.stepper_id]->setMaxSpeed(data.speed);
-            break;
+            c0 = stepper_bank[i].setAcceleration(data.accel);
+            c0_computed = true;
         }
-        return true;
+        else
+            stepper_bank[i].setAcceleration(data.accel, c0);
     }
-    return false;
 }
 
 #pragma endregion
 
-#pragma region Set Accel Packet
-
-SetAccelPacket::SetAccelPacket() : CommandPacket() {}
+#pragma region Set Profile
 
-SetAccelPacket::SetAccelPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength) : CommandPacket(buffer, bufferLength) 
+static bool validateSetProfile(const set_profile_datastruct &data)
 {
-    valid = parseData();
+    if (data.profile != AccelStepper::PROFILE_TRAPEZOIDAL && data.profile != AccelStepper::PROFILE_SCURVE)
+        return false;
+    if (data.jerk < MIN_JERK || data.jerk > MAX_JERK)
+        return false;
+    return true;
 }
 
-bool SetAccelPacket::parseData()
+static void executeSetProfile(const set_profile_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        if (!(bufferLength == sizeof(data)))
-            return false;
+        if (!(mask & (1 << i)))
+            continue;
+        stepper_bank[i].setJerk(data.jerk);
+        stepper_bank[i].setProfile((AccelStepper::Profile)data.profile);
+    }
+}
 
-        memcpy(&data, buffer, sizeof(data));
+#pragma endregion
 
-        if (data.cmd_id != commandID)
-            return false;
-        if (data.accel < MAX_ACCEL || data.accel > MAX_ACCEL)
-            return false;
-        if (!isStepperIDValid(data.stepper_id))
-            return false;
+#pragma region MoveTo
 
-        return true;
-    }
-    return false;
+static bool validateMoveTo(const moveTo_datastruct &data)
+{
+    return data.dir == 1 || data.dir == -1 || data.dir == 0;
 }
 
-bool SetAccelPacket::executeCommand()
+static void executeMoveTo(const moveTo_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        switch (data.stepper_id)
-        {
-        case selector_all:
-        {
-            float c0 = steppers[0]->setAcceleration(data.accel);
-            for (int i = 1; i < NUM_STEPPERS; i++)
-            {
-                steppers[i]->setAcceleration(data.accel, c0);
-            }
-        }
-        break;
+        if (mask & (1 << i))
+            stepper_bank[i].moveToSingleRevolution(data.position, data.dir);
+    }
+}
 
-        case selector_hour:
-        {
-            float c0 = h_steppers[0]->setAcceleration(data.accel);
-            for (int i = 1; i < NUM_STEPPERS_H; i++)
-            {
-                h_steppers[i]->setAcceleration(data.accel, c0);
-            }
-        }
-        break;
+#pragma endregion
 
-        case selector_minute:
-        {
-            float c0 = m_steppers[0]->setAcceleration(data.accel);
-            for (int i = 1; i < NUM_STEPPERS_M; i++)
-            {
-                m_steppers[i]->setAcceleration(data.accel, c0);
-            }
-        }
-        break;
+#pragma region MoveTo Extra Revs
 
-        default: // all the other stepper ids selecting individual steppers
-            steppers[data.stepper_id]->setAcceleration(data.accel);
-            break;
-        }
-        return true;
+static bool validateMoveToExtraRevs(const moveTo_extra_revs_datastruct &data)
+{
+    return data.dir == 1 || data.dir == -1 || data.dir == 0;
+}
+
+static void executeMoveToExtraRevs(const moveTo_extra_revs_datastruct &data, uint8_t mask)
+{
+    for (int i = 0; i < NUM_STEPPERS; i++)
+    {
+        if (mask & (1 << i))
+            stepper_bank[i].moveToExtraRevolutions(data.position, data.dir, data.extra_revs);
     }
-    return false;
 }
 
 #pragma endregion
 
-#pragma region MoveTo Packet
+#pragma region MoveTo Min Steps
 
-MoveToPacket::MoveToPacket() : CommandPacket() {}
+static bool validateMoveToMinSteps(const moveTo_min_steps_datastruct &data)
+{
+    return data.dir == 1 || data.dir == -1 || data.dir == 0;
+}
 
-MoveToPacket::MoveToPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength) : CommandPacket(buffer, bufferLength) 
+static void executeMoveToMinSteps(const moveTo_min_steps_datastruct &data, uint8_t mask)
 {
-    valid = parseData();
+    for (int i = 0; i < NUM_STEPPERS; i++)
+    {
+        if (mask & (1 << i))
+            stepper_bank[i].moveToMinSteps(data.position, data.dir, data.min_steps);
+    }
 }
 
-bool MoveToPacket::parseData()
+#pragma endregion
+
+#pragma region MoveTo All
+
+static bool validateMoveToAll(const moveTo_all_datastruct &data)
+{
+    if (data.cw_mask & data.ccw_mask)
+        return false;
+    // the shortest path only exists within a single revolution
+    return data.extra_revs == 0 || (data.cw_mask | data.ccw_mask) == STEPPER_MASK_ALL;
+}
+
+static void executeMoveToAll(const moveTo_all_datastruct &data, uint8_t)
 {
-    if (valid)
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        if (!(bufferLength == sizeof(data)))
-            return false;
+        int8_t dir = (data.cw_mask & (1 << i)) ? 1 : (data.ccw_mask & (1 << i)) ? -1 : 0;
+        if (data.extra_revs == 0)
+            stepper_bank[i].moveToSingleRevolution(data.positions[i], dir);
+        else
+            stepper_bank[i].moveToExtraRevolutions(data.positions[i], dir, data.extra_revs);
+    }
+}
 
-        memcpy(&data, buffer, sizeof(data));
+#pragma endregion
 
-        if (data.cmd_id != commandID)
-            return false;
+#pragma region Keyframe
 
-        // check if data is in valid range
-        if (!isStepperIDValid(data.stepper_id))
-            return false;
+// reads one delta of a keyframe, returns the number of bytes it took or 0 if the payload ends within it
+static uint8_t readKeyframeDelta(const byte *payload, uint8_t remaining, int16_t &delta)
+{
+    if (remaining < 1)
+        return 0;
+    if (!(payload[0] & 0x80))
+    {
+        delta = (int8_t)(payload[0] << 1) >> 1; // sign extend the 7 bits
+        return 1;
+    }
+    if (remaining < 2)
+        return 0;
+    delta = (int16_t)(((payload[0] & 0x7F) << 9) | (payload[1] << 1)) >> 1; // sign extend the 15 bits
+    return 2;
+}
 
-        if (data.dir != 1 && data.dir != -1 && data.dir != 0)
+static bool validateKeyframe(const keyframe_datastruct &data, const byte *payload, uint8_t payload_length)
+{
+    // there has to be exactly one delta for each selected stepper
+    uint8_t offset = 0;
+    for (int i = 0; i < NUM_STEPPERS; i++)
+    {
+        if (!(data.stepper_mask & (1 << i)))
+            continue;
+        int16_t delta = 0;
+        uint8_t delta_length = readKeyframeDelta(payload + offset, payload_length - offset, delta);
+        if (delta_length == 0)
             return false;
-
-        return true;
+        offset += delta_length;
     }
-    return false;
+    return offset == payload_length;
 }
 
-bool MoveToPacket::executeCommand()
+static void executeKeyframe(const keyframe_datastruct &data, const byte *payload, uint8_t payload_length)
 {
-    if (valid)
+    uint8_t offset = 0;
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        switch (data.stepper_id)
-        {
-        case selector_all:
-            for (int i = 0; i < NUM_STEPPERS; i++)
-            {
-                steppers[i]->moveToSingleRevolution(data.position, data.dir);
-            }
-            break;
-
-        case selector_hour:
-            for (int i = 0; i < NUM_STEPPERS_H; i++)
-            {
-                h_steppers[i]->moveToSingleRevolution(data.position, data.dir);
-            }
-            break;
-
-        case selector_minute:
-            for (int i = 0; i < NUM_STEPPERS_M; i++)
-            {
-                m_steppers[i]->moveToSingleRevolution(data.position, data.dir);
-            }
-            break;
-
-        default: // all the other stepper ids selecting individual steppers
-            steppers[data.stepper_id]->moveToSingleRevolution(data.position, data.dir);
-            break;
-        }
-        return true;
+        if (!(data.stepper_mask & (1 << i)))
+            continue;
+        int16_t delta = 0;
+        offset += readKeyframeDelta(payload + offset, payload_length - offset, delta);
+        stepper_bank[i].moveTarget(delta);
     }
-    return false;
 }
 
 #pragma endregion
 
-#pragma region MoveTo Extra Revs Packet
-
-MoveToExtraRevsPacket::MoveToExtraRevsPacket() : CommandPacket() {}
+#pragma region Move
 
-MoveToExtraRevsPacket::MoveToExtraRevsPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength) : CommandPacket(buffer, bufferLength)
+static bool validateMove(const move_datastruct &data)
 {
-    valid = parseData();
+    return data.dir == 1 || data.dir == -1 || data.dir == 0;
 }
 
-bool MoveToExtraRevsPacket::parseData()
+static void executeMove(const move_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        if (!(bufferLength == sizeof(data)))
-            return false;
+        if (!(mask & (1 << i)))
+            continue;
+        // groups move relative to their target, individual steppers relative to their current position
+        if (mask & (mask - 1))
+            stepper_bank[i].moveTarget(data.distance * data.dir);
+        else
+            stepper_bank[i].move(data.distance * data.dir);
+    }
+}
 
-        memcpy(&data, buffer, sizeof(data));
+#pragma endregion
 
-        if (data.cmd_id != commandID)
-            return false;
-        if (!isStepperIDValid(data.stepper_id))
-            return false;
-        if (data.dir != 1 && data.dir != -1 && data.dir != 0)
-            return false;
+#pragma region MoveTo Sync
 
-        return true;
-    }
-    return false;
+static bool validateMoveToSync(const moveTo_sync_datastruct &data)
+{
+    return data.dir == 1 || data.dir == -1 || (data.dir == 0 && data.extra_revs == 0);
 }
 
-bool MoveToExtraRevsPacket::executeCommand()
+static void executeMoveToSync(const moveTo_sync_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    long distances[NUM_STEPPERS];
+
+    // the slowest move sets the duration, all other steppers get their speed and accel scaled down to take as long
+    float duration = 0;
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        switch (data.stepper_id)
-        {
-        case selector_all:
-            for (int i = 0; i < NUM_STEPPERS; i++)
-            {
-                steppers[i]->moveToExtraRevolutions(data.position, data.dir, data.extra_revs);
-            }
-            break;
-
-        case selector_hour:
-            for (int i = 0; i < NUM_STEPPERS_H; i++)
-            {
-                h_steppers[i]->moveToExtraRevolutions(data.position, data.dir, data.extra_revs);
-            }
-            break;
-
-        case selector_minute:
-            for (int i = 0; i < NUM_STEPPERS_M; i++)
-            {
-                m_steppers[i]->moveToExtraRevolutions(data.position, data.dir, data.extra_revs);
-            }
-            break;
-
-        default: // all the other stepper ids selecting individual steppers
-            steppers[data.stepper_id]->moveToExtraRevolutions(data.position, data.dir, data.extra_revs);
-            break;
-        }
-        return true;
+        if (!(mask & (1 << i)))
+            continue;
+        if (data.extra_revs == 0)
+            distances[i] = stepper_bank[i].distanceToSingleRevolution(data.position, data.dir);
+        else
+            distances[i] = stepper_bank[i].distanceToExtraRevolutions(data.position, data.dir, data.extra_revs);
+
+        duration = max(duration, stepper_bank[i].moveDuration(distances[i]));
+    }
+
+    for (int i = 0; i < NUM_STEPPERS; i++)
+    {
+        if (!(mask & (1 << i)))
+            continue;
+        // the scale is kept above the minimum speed and accel, very short moves arrive a bit early then
+        float scale = (duration > 0) ? stepper_bank[i].profileScaleForDuration(distances[i], duration) : 1.0;
+        stepper_bank[i].moveScaled(distances[i], scale);
     }
-    return false;
 }
 
 #pragma endregion
 
-#pragma region MoveTo Min Steps Packet
-
-MoveToMinStepsPacket::MoveToMinStepsPacket() : CommandPacket() {}
+#pragma region MoveTo Duration
 
-MoveToMinStepsPacket::MoveToMinStepsPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength) : CommandPacket(buffer, bufferLength) 
+static bool validateMoveToDuration(const moveTo_duration_datastruct &data)
 {
-    valid = parseData();
+    if (data.dir != 1 && data.dir != -1 && !(data.dir == 0 && data.extra_revs == 0))
+        return false;
+    return data.duration != 0;
 }
 
-bool MoveToMinStepsPacket::parseData()
+static void executeMoveToDuration(const moveTo_duration_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        if (!(bufferLength == sizeof(data)))
-            return false;
+        if (mask & (1 << i))
+            stepper_bank[i].moveToDuration(data.position, data.dir, data.extra_revs, data.duration / 1000.0);
+    }
+}
 
-        memcpy(&data, buffer, sizeof(data));
+#pragma endregion
 
-        if (data.cmd_id != commandID)
-            return false;
-        if (!isStepperIDValid(data.stepper_id))
-            return false;
-        if (data.dir != 1 && data.dir != -1 && data.dir != 0)
-            return false;
+#pragma region MoveTo Queued
 
-        return true;
-    }
-    return false;
+static bool validateMoveToQueued(const moveTo_queued_datastruct &data)
+{
+    return data.dir == 1 || data.dir == -1 || (data.dir == 0 && data.extra_revs == 0);
 }
 
-bool MoveToMinStepsPacket::executeCommand()
+static void executeMoveToQueued(const moveTo_queued_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    bool queued = true;
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        switch (data.stepper_id)
-        {
-        case selector_all:
-            for (int i = 0; i < NUM_STEPPERS; i++)
-            {
-                steppers[i]->moveToMinSteps(data.position, data.dir, data.min_steps);
-            }
-            break;
-
-        case selector_hour:
-            for (int i = 0; i < NUM_STEPPERS_H; i++)
-            {
-                h_steppers[i]->moveToMinSteps(data.position, data.dir, data.min_steps);
-            }
-            break;
-
-        case selector_minute:
-            for (int i = 0; i < NUM_STEPPERS_M; i++)
-            {
-                m_steppers[i]->moveToMinSteps(data.position, data.dir, data.min_steps);
-            }
-            break;
-
-        default: // all the other stepper ids selecting individual steppers
-            steppers[data.stepper_id]->moveToMinSteps(data.position, data.dir, data.min_steps);
-            break;
-        }
-        return true;
+        if (mask & (1 << i))
+            queued &= stepper_bank[i].queueMoveTo(data.position, data.dir, data.extra_revs);
     }
-    return false;
+#if DEBUG
+    if (!queued)
+        Serial.println("move queue full, dropped the move");
+#endif
 }
 
 #pragma endregion
 
-#pragma region Move Packet
+#pragma region Stop
 
-MovePacket::MovePacket() : CommandPacket() {}
-
-MovePacket::MovePacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength) : CommandPacket(buffer, bufferLength) 
+static bool validateStop(const stop_datastruct &)
 {
-    valid = parseData();
+    return true;
 }
 
-bool MovePacket::parseData()
+static void executeStop(const stop_datastruct &, uint8_t mask)
 {
-    if (valid)
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        if (!(bufferLength == sizeof(data)))
-            return false;
+        if (mask & (1 << i))
+            stepper_bank[i].stop();
+    }
+}
 
-        memcpy(&data, buffer, sizeof(data));
+#pragma endregion
 
-        if (data.cmd_id != commandID)
-            return false;
-        if (!isStepperIDValid(data.stepper_id))
-            return false;
-        if (data.dir != 1 && data.dir != -1 && data.dir != 0)
-            return false;
+#pragma region Wiggle
 
-        return true;
-    }
-    return false;
+static bool validateWiggle(const wiggle_datastruct &data)
+{
+    return data.dir == 1 || data.dir == -1;
 }
 
-bool MovePacket::executeCommand()
+static void executeWiggle(const wiggle_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        switch (data.stepper_id)
-        {
-        case selector_all:
-            for (int i = 0; i < NUM_STEPPERS; i++)
-            {
-                steppers[i]->moveTarget(data.distance * data.dir);
-            }
-            break;
-
-        case selector_hour:
-            for (int i = 0; i < NUM_STEPPERS_H; i++)
-            {
-                h_steppers[i]->moveTarget(data.distance * data.dir);
-            }
-            break;
-
-        case selector_minute:
-            for (int i = 0; i < NUM_STEPPERS_M; i++)
-            {
-                m_steppers[i]->moveTarget(data.distance * data.dir);
-            }
-            break;
-
-        default: // all the other stepper ids selecting individual steppers
-            steppers[data.stepper_id]->move(data.distance * data.dir);
-            break;
-        }
-        return true;
+        if (mask & (1 << i))
+            stepper_bank[i].wiggle(data.distance * data.dir);
     }
-    return false;
 }
 
 #pragma endregion
 
-#pragma region Stop Packet
+#pragma region Query
 
-StopPacket::StopPacket() : CommandPacket() {}
+// written by the loop and read by the i2c request interrupt
+byte query_reply[MAX_QUERY_REPLY_LENGTH] = {query_none};
+uint8_t query_reply_length = 1;
 
-StopPacket::StopPacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength) : CommandPacket(buffer, bufferLength) 
+static bool validateQuery(const query_datastruct &data)
 {
-    valid = parseData();
+    return data.query == query_none || data.query == query_time_to_target || data.query == query_drain_stats;
 }
 
-bool StopPacket::parseData()
+static uint8_t writeLittleEndian(byte *buffer, uint32_t value, uint8_t size)
 {
-    if (valid)
+    for (uint8_t i = 0; i < size; i++)
     {
-        if (!(bufferLength == sizeof(data)))
-            return false;
-
-        memcpy(&data, buffer, sizeof(data));
-
-        if (data.cmd_id != commandID)
-            return false;
-        if (!isStepperIDValid(data.stepper_id))
-            return false;
-
-        return true;
+        buffer[i] = value >> (8 * i);
     }
-    return false;
+    return size;
 }
 
-bool StopPacket::executeCommand()
+static void executeQuery(const query_datastruct &data, uint8_t mask)
 {
-    if (valid)
+    // the answer is computed with interrupts enabled, only swapping it in has to be done without them
+    byte reply[MAX_QUERY_REPLY_LENGTH];
+    uint8_t length = 0;
+    reply[length++] = data.query;
+    if (data.query == query_time_to_target)
     {
-        switch (data.stepper_id)
+        for (int i = 0; i < NUM_STEPPERS; i++)
         {
-        case selector_all:
-            for (int i = 0; i < NUM_STEPPERS; i++)
-            {
-                steppers[i]->stop();
-            }
-            break;
-
-        case selector_hour:
-            for (int i = 0; i < NUM_STEPPERS_H; i++)
-            {
-                h_steppers[i]->stop();
-            }
-            break;
-
-        case selector_minute:
-            for (int i = 0; i < NUM_STEPPERS_M; i++)
-            {
-                m_steppers[i]->stop();
-            }
-            break;
-
-        default: // all the other stepper ids selecting individual steppers
-            steppers[data.stepper_id]->stop();
-            break;
+            if (!(mask & (1 << i)))
+                continue;
+            uint16_t time_ms = min(stepper_bank[i].timeToTarget() * 1000.0f, 65535.0f);
+            length += writeLittleEndian(reply + length, time_ms, 2);
         }
-        return true;
     }
-    return false;
+    else if (data.query == query_drain_stats)
+    {
+        // the stats are only changed by the loop, which is executing this
+        CommandDrainStats stats = commandDrainStats();
+        resetCommandDrainStats();
+        length += writeLittleEndian(reply + length, commandDrainBudget(), 2);
+        length += writeLittleEndian(reply + length, stats.commands, 4);
+        length += writeLittleEndian(reply + length, stats.passes, 4);
+        length += writeLittleEndian(reply + length, stats.max_per_pass, 2);
+        length += writeLittleEndian(reply + length, stats.budget_exhausted, 4);
+    }
+
+    noInterrupts();
+    memcpy(query_reply, reply, length);
+    query_reply_length = length;
+    interrupts();
 }
 
-#pragma endregion
+uint8_t queryReply(byte *buffer)
+{
+    memcpy(buffer, query_reply, query_reply_length);
+    return query_reply_length;
+}
 
-#pragma region Wiggle Packet
+#pragma endregion
 
-WigglePacket::WigglePacket() : CommandPacket() {}
+#pragma region Set Drain Budget
 
-WigglePacket::WigglePacket(byte (&buffer)[MAX_COMMAND_LENGTH], uint8_t bufferLength) : CommandPacket(buffer, bufferLength) 
+static bool validateSetDrainBudget(const set_drain_budget_datastruct &data)
 {
-    valid = parseData();
+    return data.budget_us <= MAX_COMMAND_DRAIN_BUDGET_US;
 }
 
-bool WigglePacket::parseData()
+static void executeSetDrainBudget(const set_drain_budget_datastruct &data, uint8_t)
 {
-    if (valid)
-    {
-        if (!(bufferLength == sizeof(data)))
-            return false;
+    // takes effect with the next pass, the one executing this keeps its budget
+    setCommandDrainBudget(data.budget_us);
+}
 
-        memcpy(&data, buffer, sizeof(data));
+#pragma endregion
 
-        if (data.cmd_id != commandID)
-            return false;
-        if (!isStepperIDValid(data.stepper_id))
-            return false;
-        if (data.dir != 1 && data.dir != -1)
-            return false;
+#pragma region Dispatch table
 
+// reads which steppers a command selects, the stepper_id is a bitmask if the command id has SELECTOR_MASK_FLAG set
+// returns false if the selection is invalid
+template <typename T>
+static auto readSelection(const T *data, bool masked, uint8_t &mask) -> decltype(data->stepper_id, bool())
+{
+    if (masked)
+    {
+        mask = (uint8_t)data->stepper_id;
         return true;
     }
-    return false;
+    if (!isStepperIDValid(data->stepper_id))
+        return false;
+    mask = selectionMask(data->stepper_id);
+    return true;
 }
 
-bool WigglePacket::executeCommand()
+// commands without a stepper_id apply to the whole module and have no masked variant
+static bool readSelection(const void *, bool masked, uint8_t &mask)
 {
-    if (valid)
-    {
-        switch (data.stepper_id)
-        {
-        case selector_all:
-            for (int i = 0; i < NUM_STEPPERS; i++)
-            {
-                steppers[i]->wiggle(data.distance * data.dir);
-            }
-            break;
-
-        case selector_hour:
-            for (int i = 0; i < NUM_STEPPERS_H; i++)
-            {
-                h_steppers[i]->wiggle(data.distance * data.dir);
-            }
-            break;
-
-        case selector_minute:
-            for (int i = 0; i < NUM_STEPPERS_M; i++)
-            {
-                m_steppers[i]->wiggle(data.distance * data.dir);
-            }
-            break;
-
-        default: // all the other stepper ids selecting individual steppers
-            steppers[data.stepper_id]->wiggle(data.distance * data.dir);
-            break;
-        }
-        return true;
-    }
-    return false;
+    mask = 0;
+    return !masked;
+}
+
+// adapt the typed functions of a command to the buffer it was received in, the packed structs can be viewed at any address
+template <typename T, bool (*validate)(const T &)>
+static bool validateBuffer(const byte *buffer, uint8_t bufferLength)
+{
+    if (bufferLength != sizeof(T))
+        return false;
+    const T &data = *reinterpret_cast<const T *>(buffer);
+    uint8_t mask = 0;
+    return readSelection(&data, buffer[0] & SELECTOR_MASK_FLAG, mask) && validate(data);
+}
+
+template <typename T, void (*execute)(const T &, uint8_t)>
+static void executeBuffer(const byte *buffer, uint8_t)
+{
+    const T &data = *reinterpret_cast<const T *>(buffer);
+    uint8_t mask = 0;
+    readSelection(&data, buffer[0] & SELECTOR_MASK_FLAG, mask);
+    execute(data, mask);
+}
+
+// commands with a payload between the datastruct and the checksum, they select their steppers themselves
+template <typename T, bool (*validate)(const T &, const byte *, uint8_t)>
+static bool validateBuffer(const byte *buffer, uint8_t bufferLength)
+{
+    if (bufferLength < sizeof(T) + 1)
+        return false;
+    const T &data = *reinterpret_cast<const T *>(buffer);
+    uint8_t mask = 0;
+    return readSelection(&data, buffer[0] & SELECTOR_MASK_FLAG, mask) && validate(data, buffer + sizeof(T), bufferLength - sizeof(T) - 1);
+}
+
+template <typename T, void (*execute)(const T &, const byte *, uint8_t)>
+static void executeBuffer(const byte *buffer, uint8_t bufferLength)
+{
+    execute(*reinterpret_cast<const T *>(buffer), buffer + sizeof(T), bufferLength - sizeof(T) - 1);
+}
+
+// the steppers a command changes, commands without a stepper_id either name them in their own fields or only change
+// module wide settings
+template <typename T>
+static uint8_t changedSteppers(const T *data, bool masked)
+{
+    uint8_t mask = 0;
+    readSelection(data, masked, mask);
+    return mask;
+}
+
+static uint8_t changedSteppers(const moveTo_all_datastruct *, bool)
+{
+    return STEPPER_MASK_ALL;
+}
+
+static uint8_t changedSteppers(const keyframe_datastruct *data, bool)
+{
+    return data->stepper_mask;
+}
+
+static uint8_t changedSteppers(const query_datastruct *, bool)
+{
+    return 0; // only reads the steppers
+}
+
+template <typename T>
+static uint8_t selectBuffer(const byte *buffer, uint8_t)
+{
+    return changedSteppers(reinterpret_cast<const T *>(buffer), buffer[0] & SELECTOR_MASK_FLAG);
+}
+
+static_assert(1 + 2 + 4 + 4 + 2 + 4 <= MAX_QUERY_REPLY_LENGTH, "the drain stats have to fit the query reply");
+static_assert(CMD_ID_MAX < SELECTOR_MASK_FLAG, "command ids have to leave the selector mask flag free");
+static_assert(BATCH_FRAME_ID > (CMD_ID_MAX | SELECTOR_MASK_FLAG), "the batch frame id has to differ from all command ids");
+
+#define COMMAND_FITS(id, datastruct, name) static_assert(sizeof(datastruct) <= MAX_COMMAND_LENGTH, #datastruct " is longer than MAX_COMMAND_LENGTH");
+COMMAND_LIST(COMMAND_FITS)
+#undef COMMAND_FITS
+
+// indexed by command id, lives in flash
+#define COMMAND_ENTRY(id, datastruct, name) {validateBuffer<datastruct, validate##name>, executeBuffer<datastruct, execute##name>, selectBuffer<datastruct>},
+static constexpr CommandEntry command_table[cmd_count] = {COMMAND_LIST(COMMAND_ENTRY)};
+#undef COMMAND_ENTRY
+
+const CommandEntry *parseCommand(const byte *buffer, uint8_t bufferLength)
+{
+    uint8_t command_id = buffer[0] & ~SELECTOR_MASK_FLAG;
+    if (!isCommandIDValid(command_id))
+        return nullptr;
+
+    const CommandEntry *command = &command_table[command_id];
+    if (!verifyChecksum(buffer, bufferLength))
+        return nullptr;
+    if (!command->validate(buffer, bufferLength))
+        return nullptr;
+
+    return command;
 }
 
 #pragma endregion
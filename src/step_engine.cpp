@@ -0,0 +1,135 @@
+#include <Arduino.h>
+#include <limits.h>
+#include "config.h"
+#include "step_engine.h"
+#include "steppers.h"
+#include "step_output.h"
+#include "step_scheduler.h"
+#include "driver_power.h"
+
+StepScheduler step_scheduler;
+// steppers a command is changing, see stepEngineLock()
+volatile uint8_t locked_steppers = 0;
+
+#if STEP_ENGINE_USE_TIMER
+#if STEP_TIMER_MAX_DELAY_US >= 0x10000
+  #error "STEP_TIMER_MAX_DELAY_US has to fit the 16 bit timer counter"
+#endif
+
+HardwareTimer step_timer(STEP_TIMER);
+// the timer only runs while there is something to do, so an idle core isnt woken up by it
+volatile bool step_timer_running = false;
+
+// sets the compare interrupt to the next step deadline, or to lowering the step pins while a pulse is high
+// so the core is only woken up when there is something to do, pauses the timer if there is nothing left
+void armStepTimer()
+{
+    if (stepEngineIdle())
+    {
+        if (step_timer_running)
+        {
+            step_timer.pause();
+            step_timer_running = false;
+        }
+        return;
+    }
+    if (!step_timer_running)
+    {
+        step_timer.resume();
+        step_timer_running = true;
+    }
+
+    unsigned long delay = step_scheduler.timeUntilNext(micros());
+    if (!step_output.isIdle())
+        delay = min(delay, (unsigned long)STEP_TIMER_MIN_DELAY_US);
+    delay = constrain(delay, (unsigned long)STEP_TIMER_MIN_DELAY_US, (unsigned long)STEP_TIMER_MAX_DELAY_US);
+
+    // the counter runs freely and the compare value wraps around with it
+    // if the counter already passed the compare value when it is written, it would only match a whole wrap later
+    uint16_t compare;
+    do
+    {
+        compare = step_timer.getCount() + delay;
+        step_timer.setCaptureCompare(STEP_TIMER_CHANNEL, compare, TICK_COMPARE_FORMAT);
+        delay = STEP_TIMER_MIN_DELAY_US;
+    } while ((uint16_t)(compare - step_timer.getCount()) > STEP_TIMER_MAX_DELAY_US);
+}
+#endif
+
+void initializeStepEngine()
+{
+    step_scheduler.rescheduleAll(micros());
+#if STEP_ENGINE_USE_TIMER
+    // counts microseconds over the full 16 bit range, the compare channel interrupts at the next deadline
+    step_timer.setPrescaleFactor(step_timer.getTimerClkFreq() / 1000000);
+    step_timer.setOverflow(0x10000, TICK_FORMAT);
+    step_timer.setMode(STEP_TIMER_CHANNEL, TIMER_OUTPUT_COMPARE);
+    step_timer.attachInterrupt(STEP_TIMER_CHANNEL, stepEngineTick);
+    armStepTimer();
+#endif
+}
+
+void stepEngineTick()
+{
+    step_scheduler.runDue(micros(), locked_steppers);
+    step_output.flush();
+#if STEP_ENGINE_USE_TIMER
+    armStepTimer();
+#endif
+}
+
+void stepEnginePoll()
+{
+#if STEP_ENGINE_USE_TIMER
+    // precompute the upcoming ramp steps so the interrupt only has to take them
+    for (uint8_t i = 0; i < NUM_STEPPERS; i++)
+    {
+        stepper_bank[i].planSteps();
+    }
+#else
+    stepEngineTick();
+#endif
+}
+
+unsigned long stepEngineTimeUntilPoll()
+{
+#if STEP_ENGINE_USE_TIMER
+    return ULONG_MAX;
+#else
+    return step_scheduler.timeUntilNext(micros());
+#endif
+}
+
+bool stepEngineIdle()
+{
+    return step_scheduler.isEmpty() && step_output.isIdle();
+}
+
+void stepEngineLock(uint8_t stepper_mask)
+{
+    locked_steppers = stepper_mask;
+    // the tick has to see the lock before the stepper state changes
+    __sync_synchronize();
+}
+
+void stepEngineUnlock()
+{
+    // the command ran with interrupts enabled, only handing the changed steppers back to the tick is done without them
+#if STEP_ENGINE_USE_TIMER
+    noInterrupts();
+#endif
+    // the command may have started or changed moves
+    unsigned long now = micros();
+    for (uint8_t i = 0; i < NUM_STEPPERS; i++)
+    {
+        if (locked_steppers & (1 << i))
+            step_scheduler.reschedule(i, now);
+    }
+    locked_steppers = 0;
+    driverPowerOnCommand();
+#if STEP_ENGINE_USE_TIMER
+    // the next deadline can be earlier than the one the timer is set to
+    armStepTimer();
+    interrupts();
+#endif
+}
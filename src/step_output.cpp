@@ -0,0 +1,150 @@
+#include <Arduino.h>
+#include <AccelStepper.h>
+#include "config.h"
+#include "step_output.h"
+#include "step_engine.h"
+
+#if STEP_PULSE_TWO_PHASE && STEP_ENGINE_USE_TIMER && STEP_TIMER_MIN_DELAY_US < STEP_MIN_PULSE_WIDTH_US
+  #error "the two phase step pulse lasts until the next tick, STEP_TIMER_MIN_DELAY_US has to be at least STEP_MIN_PULSE_WIDTH_US"
+#endif
+
+// only zero initialized, so it is ready before the constructors of the steppers register their ports
+StepOutputBatch step_output;
+
+#pragma region Step Output Batch
+
+uint8_t StepOutputBatch::registerPort(uint8_t pin)
+{
+#if STEP_OUTPUT_USE_PORTS
+    GPIO_TypeDef *port = digitalPinToPort(pin);
+    for (uint8_t i = 0; i < num_ports; i++)
+    {
+        if (ports[i] == port)
+            return i;
+    }
+    if (num_ports >= STEP_OUTPUT_MAX_PORTS)
+        return STEP_OUTPUT_NO_PORT;
+    ports[num_ports] = port;
+    return num_ports++;
+#else
+    (void)(pin); // Unused
+    return 0;
+#endif
+}
+
+void StepOutputBatch::addStep(uint8_t step_port, uint32_t step_mask, uint8_t dir_port, uint32_t dir_mask, bool dir)
+{
+#if STEP_OUTPUT_USE_PORTS
+    dir_bits[dir_port] |= dir ? dir_mask : dir_mask << 16;
+    step_bits[step_port] |= step_mask;
+    pending = true;
+#else
+    (void)(step_port); // Unused
+    (void)(step_mask); // Unused
+    (void)(dir_port); // Unused
+    (void)(dir_mask); // Unused
+    (void)(dir); // Unused
+#endif
+}
+
+void StepOutputBatch::flush()
+{
+#if STEP_OUTPUT_USE_PORTS
+#if STEP_PULSE_TWO_PHASE
+    // the pulses raised in the previous tick are at least STEP_TIMER_MIN_DELAY_US long by now
+    if (pulse_high)
+        lowerStepPins();
+#endif
+    if (!pending)
+        return;
+
+    bool dir_changed = false;
+    for (uint8_t i = 0; i < num_ports; i++)
+    {
+        if (dir_bits[i])
+        {
+            uint32_t odr = ports[i]->ODR;
+            uint32_t set_mask = dir_bits[i] & 0xFFFF;
+            uint32_t reset_mask = dir_bits[i] >> 16;
+            dir_changed |= (odr & set_mask) != set_mask || (odr & reset_mask);
+            ports[i]->BSRR = dir_bits[i];
+            dir_bits[i] = 0;
+        }
+    }
+    // only wait for the dir setup time if a direction actually changed, which is rare
+    if (dir_changed)
+        delayMicroseconds(STEP_DIR_SETUP_US);
+
+    for (uint8_t i = 0; i < num_ports; i++)
+    {
+        ports[i]->BSRR = step_bits[i];
+        step_high_bits[i] = step_bits[i];
+        step_bits[i] = 0;
+    }
+    pending = false;
+    pulse_high = true;
+#if STEP_PULSE_TWO_PHASE
+#if !STEP_ENGINE_USE_TIMER
+    pulse_start = micros();
+#endif
+#else
+    delayMicroseconds(STEP_MIN_PULSE_WIDTH_US);
+    lowerStepPins();
+#endif
+#endif
+}
+
+bool StepOutputBatch::isIdle()
+{
+#if STEP_OUTPUT_USE_PORTS
+    return !pending && !pulse_high;
+#else
+    return true;
+#endif
+}
+
+#if STEP_OUTPUT_USE_PORTS
+void StepOutputBatch::lowerStepPins()
+{
+#if STEP_PULSE_TWO_PHASE && !STEP_ENGINE_USE_TIMER
+    // without the timer the next flush can come right away, wait for the rest of the pulse width
+    while (micros() - pulse_start < STEP_MIN_PULSE_WIDTH_US)
+        ;
+#endif
+    for (uint8_t i = 0; i < num_ports; i++)
+    {
+        ports[i]->BSRR = step_high_bits[i] << 16;
+    }
+    pulse_high = false;
+}
+#endif
+
+#pragma endregion
+
+#pragma region Batched Stepper
+
+BatchedStepper::BatchedStepper(uint8_t step_pin, uint8_t dir_pin, uint16_t stepsPerRevolution) : AccelStepper(step_pin, dir_pin, stepsPerRevolution)
+{
+#if STEP_OUTPUT_USE_PORTS
+    step_port = step_output.registerPort(step_pin);
+    dir_port = step_output.registerPort(dir_pin);
+    step_mask = digitalPinToBitMask(step_pin);
+    dir_mask = digitalPinToBitMask(dir_pin);
+    // with more ports than STEP_OUTPUT_MAX_PORTS the stepper writes its pins itself, slower but still correct
+    batched = step_port != STEP_OUTPUT_NO_PORT && dir_port != STEP_OUTPUT_NO_PORT;
+#endif
+}
+
+void BatchedStepper::step1(long step)
+{
+#if STEP_OUTPUT_USE_PORTS
+    if (batched)
+        step_output.addStep(step_port, step_mask, dir_port, dir_mask, _direction);
+    else
+        AccelStepper::step1(step);
+#else
+    AccelStepper::step1(step);
+#endif
+}
+
+#pragma endregion
@@ -0,0 +1,142 @@
+#include <Arduino.h>
+#include <limits.h>
+#include "config.h"
+#include "step_scheduler.h"
+#include "steppers.h"
+
+StepScheduler::StepScheduler()
+{
+    heap_size = 0;
+    for (uint8_t i = 0; i < NUM_STEPPERS; i++)
+    {
+        heap_position[i] = -1;
+    }
+}
+
+void StepScheduler::reschedule(uint8_t stepper_index, unsigned long now)
+{
+    stepper_bank.updateRunning(stepper_index);
+
+    if (!stepper_bank[stepper_index].isScheduled())
+    {
+        remove(stepper_index);
+        return;
+    }
+
+    deadline[stepper_index] = stepper_bank[stepper_index].nextRunTime(now);
+
+    if (heap_position[stepper_index] < 0)
+    {
+        heap[heap_size] = stepper_index;
+        heap_position[stepper_index] = heap_size;
+        heap_size++;
+    }
+    // the deadline can have moved either way
+    siftUp(heap_position[stepper_index]);
+    siftDown(heap_position[stepper_index]);
+}
+
+void StepScheduler::rescheduleAll(unsigned long now)
+{
+    for (uint8_t i = 0; i < NUM_STEPPERS; i++)
+    {
+        reschedule(i, now);
+    }
+}
+
+void StepScheduler::runDue(unsigned long now, uint8_t locked_mask)
+{
+    // collect first, so a stepper that is due again right away waits for the next call
+    uint8_t due[NUM_STEPPERS];
+    uint8_t num_due = 0;
+    while (heap_size > 0 && (long)(now - deadline[heap[0]]) >= 0)
+    {
+        due[num_due++] = heap[0];
+        remove(heap[0]);
+    }
+
+    for (uint8_t i = 0; i < num_due; i++)
+    {
+        if (locked_mask & (1 << due[i]))
+            continue;
+        stepper_bank[due[i]].run(now);
+        reschedule(due[i], now);
+    }
+}
+
+unsigned long StepScheduler::timeUntilNext(unsigned long now)
+{
+    if (heap_size == 0)
+        return ULONG_MAX;
+    long remaining = (long)(deadline[heap[0]] - now);
+    return remaining > 0 ? remaining : 0;
+}
+
+bool StepScheduler::isEmpty()
+{
+    return heap_size == 0;
+}
+
+bool StepScheduler::isEarlier(uint8_t heap_index_a, uint8_t heap_index_b)
+{
+    // deadlines are at most one step interval away from now, so the wrapping difference is safe
+    return (long)(deadline[heap[heap_index_a]] - deadline[heap[heap_index_b]]) < 0;
+}
+
+void StepScheduler::swap(uint8_t heap_index_a, uint8_t heap_index_b)
+{
+    uint8_t temp = heap[heap_index_a];
+    heap[heap_index_a] = heap[heap_index_b];
+    heap[heap_index_b] = temp;
+    heap_position[heap[heap_index_a]] = heap_index_a;
+    heap_position[heap[heap_index_b]] = heap_index_b;
+}
+
+void StepScheduler::siftUp(uint8_t heap_index)
+{
+    while (heap_index > 0)
+    {
+        uint8_t parent = (heap_index - 1) / 2;
+        if (!isEarlier(heap_index, parent))
+            return;
+        swap(heap_index, parent);
+        heap_index = parent;
+    }
+}
+
+void StepScheduler::siftDown(uint8_t heap_index)
+{
+    while (true)
+    {
+        uint8_t earliest = heap_index;
+        uint8_t left = 2 * heap_index + 1;
+        uint8_t right = left + 1;
+        if (left < heap_size && isEarlier(left, earliest))
+            earliest = left;
+        if (right < heap_size && isEarlier(right, earliest))
+            earliest = right;
+        if (earliest == heap_index)
+            return;
+        swap(heap_index, earliest);
+        heap_index = earliest;
+    }
+}
+
+void StepScheduler::remove(uint8_t stepper_index)
+{
+    int8_t heap_index = heap_position[stepper_index];
+    if (heap_index < 0)
+        return;
+
+    heap_size--;
+    heap_position[stepper_index] = -1;
+    if (heap_index == heap_size)
+        return;
+
+    // move the last element into the gap and restore the heap order
+    uint8_t moved = heap[heap_size];
+    heap[heap_index] = moved;
+    heap_position[moved] = heap_index;
+    siftUp(heap_index);
+    siftDown(heap_position[moved]);
+}
@@ -1,41 +1,50 @@
 #include "steppers.h"
 #include "AccelStepper.h"
 #include "config.h"
+#include "step_output.h"
 
+StepperBank stepper_bank;
+
+StepperBank::StepperBank() : steppers{
 #if BROKEN_PCB
-AccelStepper x1m(17, 20, STEPS_PER_REVOLUTION);//broken maple cutoff from black rev 1 pcb
+    BatchedStepper(17, 20, STEPS_PER_REVOLUTION), //x1m broken maple cutoff from black rev 1 pcb
 #else
-AccelStepper x1m(26, 27, STEPS_PER_REVOLUTION);//normal green
+    BatchedStepper(26, 27, STEPS_PER_REVOLUTION), //x1m normal green
 #endif
-AccelStepper x1h(14, 25, STEPS_PER_REVOLUTION);
-AccelStepper x2m(4,  5,  STEPS_PER_REVOLUTION);
-AccelStepper x2h(2,  3,  STEPS_PER_REVOLUTION);
-AccelStepper x3m(10, 11, STEPS_PER_REVOLUTION);
-AccelStepper x3h(12, 13, STEPS_PER_REVOLUTION);
-AccelStepper x4m(8,  9,  STEPS_PER_REVOLUTION);
-AccelStepper x4h(7,  6,  STEPS_PER_REVOLUTION);
+    BatchedStepper(4,  5,  STEPS_PER_REVOLUTION), //x2m
+    BatchedStepper(10, 11, STEPS_PER_REVOLUTION), //x3m
+    BatchedStepper(8,  9,  STEPS_PER_REVOLUTION), //x4m
+    BatchedStepper(14, 25, STEPS_PER_REVOLUTION), //x1h
+    BatchedStepper(2,  3,  STEPS_PER_REVOLUTION), //x2h
+    BatchedStepper(12, 13, STEPS_PER_REVOLUTION), //x3h
+    BatchedStepper(7,  6,  STEPS_PER_REVOLUTION)} //x4h
+{
+    running_mask = 0;
+}
 
-AccelStepper *steppers[] = {&x1m, &x2m, &x3m, &x4m, &x1h, &x2h, &x3h, &x4h};
-AccelStepper *h_steppers[] = {&x1h, &x2h, &x3h, &x4h};
-AccelStepper *m_steppers[] = {&x1m, &x2m, &x3m, &x4m};
+void StepperBank::updateRunning(uint8_t stepper_index)
+{
+    // a stepper between two queued moves counts as running
+    if (steppers[stepper_index].isRunning() || steppers[stepper_index].queuedMoves())
+        running_mask |= (1 << stepper_index);
+    else
+        running_mask &= ~(1 << stepper_index);
+}
 
 // Initialize steppers in your CPP file
 void initializeSteppers() {
-    for (int i = 0; i < NUM_STEPPERS_H; i++)
+    for (int i = 0; i < NUM_STEPPERS; i++)
     {
-        h_steppers[i]->setPinModesDriver();
-        h_steppers[i]->setMaxSpeed(STEPPER_DEFAULT_SPEED);
-        h_steppers[i]->setAcceleration(STEPPER_DEFAULT_ACCEL);
-        h_steppers[i]->setCurrentPosition((int)(STEPS_PER_REVOLUTION * STEPPER_DEFAULT_POS_FRACTION));
-        h_steppers[i]->moveToSingleRevolution(0, -1);
-    }
+        // the hour hands start turning ccw and the minute hands cw
+        int8_t dir = (STEPPER_MASK_H & (1 << i)) ? -1 : 1;
 
-    for (int i = 0; i < NUM_STEPPERS_M; i++)
-    {
-        m_steppers[i]->setPinModesDriver();
-        m_steppers[i]->setMaxSpeed(STEPPER_DEFAULT_SPEED);
-        m_steppers[i]->setAcceleration(STEPPER_DEFAULT_ACCEL);
-        m_steppers[i]->setCurrentPosition((int)(STEPS_PER_REVOLUTION * STEPPER_DEFAULT_POS_FRACTION));
-        m_steppers[i]->moveToSingleRevolution(0, 1);
+        stepper_bank[i].setPinModesDriver();
+        stepper_bank[i].setTwoPhasePulse(STEP_PULSE_TWO_PHASE);
+        stepper_bank[i].setMaxSpeed(STEPPER_DEFAULT_SPEED);
+        stepper_bank[i].setAcceleration(STEPPER_DEFAULT_ACCEL);
+        stepper_bank[i].setJerk(STEPPER_DEFAULT_JERK);
+        stepper_bank[i].setScaleLimits(MIN_SPEED, MAX_SPEED, MIN_ACCEL, MAX_ACCEL);
+        stepper_bank[i].setCurrentPosition((int)(STEPS_PER_REVOLUTION * STEPPER_DEFAULT_POS_FRACTION));
+        stepper_bank[i].moveToSingleRevolution(0, dir);
     }
 }
\ No newline at end of file
@@ -0,0 +1,232 @@
+#pragma once
+
+// host stand-in for the parts of the STM32duino core the firmware uses, so src/ and the library build in env:native
+// time only passes when a test advances the simulated clock, interrupts are taken exactly when they are due
+// pins 0-15 are on GPIOA, 16-31 on GPIOB and so on, every level change of a pin is reported to shim::on_pin_change
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define HEX 16
+
+using std::min;
+using std::max;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define SHIM_NUM_PORTS 4
+#define SHIM_NUM_PINS (SHIM_NUM_PORTS * 16)
+
+namespace shim
+{
+    inline unsigned long now_us = 0;
+    inline bool interrupts_enabled = true;
+    inline uint8_t pin_level[SHIM_NUM_PINS];
+    inline void (*on_pin_change)(uint8_t pin, bool level) = nullptr;
+
+    inline void setPin(uint8_t pin, bool level)
+    {
+        if (pin >= SHIM_NUM_PINS || pin_level[pin] == level)
+            return;
+        pin_level[pin] = level;
+        if (on_pin_change)
+            on_pin_change(pin, level);
+    }
+}
+
+#pragma region time
+
+// advances the clock to time, taking the interrupts that are due on the way, defined with the timer below
+void shimAdvanceTo(unsigned long time);
+
+inline unsigned long micros() { return shim::now_us; }
+inline unsigned long millis() { return shim::now_us / 1000; }
+// busy waiting, the interrupts that come due meanwhile are only taken after it
+inline void delayMicroseconds(unsigned int us) { shim::now_us += us; }
+inline void delay(unsigned long ms) { shimAdvanceTo(shim::now_us + ms * 1000); }
+inline void yield() {}
+
+#pragma endregion
+
+#pragma region interrupts
+
+inline void noInterrupts() { shim::interrupts_enabled = false; }
+inline void interrupts()
+{
+    shim::interrupts_enabled = true;
+    // take what became pending while they were disabled
+    shimAdvanceTo(shim::now_us);
+}
+
+// sleeps until the next interrupt, which is taken as soon as interrupts are enabled, the systick wakes up every millisecond
+void __WFI();
+
+#pragma endregion
+
+#pragma region gpio
+
+inline void pinMode(uint8_t pin, uint8_t mode) { (void)(pin); (void)(mode); }
+inline void digitalWrite(uint8_t pin, uint8_t level) { shim::setPin(pin, level); }
+
+typedef struct GPIO_TypeDef GPIO_TypeDef;
+
+// writing the bit set reset register changes the output data register and reports the changed pins
+struct ShimBsrrRegister
+{
+    void operator=(uint32_t value);
+};
+
+struct GPIO_TypeDef
+{
+    volatile uint32_t ODR;
+    ShimBsrrRegister BSRR;
+};
+
+namespace shim
+{
+    inline GPIO_TypeDef ports[SHIM_NUM_PORTS];
+}
+
+inline void ShimBsrrRegister::operator=(uint32_t value)
+{
+    GPIO_TypeDef *port = (GPIO_TypeDef *)((char *)this - offsetof(GPIO_TypeDef, BSRR));
+    uint32_t odr = (port->ODR & ~(value >> 16)) | (value & 0xFFFF);
+    port->ODR = odr;
+    uint8_t first_pin = (port - shim::ports) * 16;
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        shim::setPin(first_pin + i, (odr >> i) & 1);
+    }
+}
+
+inline GPIO_TypeDef *digitalPinToPort(uint8_t pin) { return &shim::ports[pin / 16]; }
+inline uint32_t digitalPinToBitMask(uint8_t pin) { return 1UL << (pin % 16); }
+
+#pragma endregion
+
+#pragma region timer
+
+typedef struct { uint8_t id; } TIM_TypeDef;
+inline TIM_TypeDef shim_tim2 = {2};
+#define TIM2 (&shim_tim2)
+
+typedef enum { TICK_FORMAT, MICROSEC_FORMAT, HERTZ_FORMAT } TimerFormat_t;
+typedef enum { TICK_COMPARE_FORMAT, MICROSEC_COMPARE_FORMAT, HERTZ_COMPARE_FORMAT } TimerCompareFormat_t;
+typedef enum { TIMER_DISABLED, TIMER_OUTPUT_COMPARE } TimerModes_t;
+typedef void (*callback_function_t)(void);
+
+// free running counter with the compare interrupt of one channel, it counts once per microsecond of the simulated
+// clock, so the prescaler is expected to be set to a microsecond
+class HardwareTimer
+{
+public:
+    HardwareTimer(TIM_TypeDef *instance) { (void)(instance); active = this; }
+    uint32_t getTimerClkFreq() { return 72000000; }
+    void setPrescaleFactor(uint32_t prescaler) { (void)(prescaler); }
+    void setOverflow(uint32_t overflow, TimerFormat_t format = TICK_FORMAT) { (void)(format); this->overflow = overflow; }
+    void setMode(uint32_t channel, TimerModes_t mode) { (void)(channel); (void)(mode); }
+    void attachInterrupt(uint32_t channel, callback_function_t callback) { (void)(channel); this->callback = callback; }
+    uint32_t getCount(TimerFormat_t format = TICK_FORMAT)
+    {
+        (void)(format);
+        return running ? (shim::now_us - start) % overflow : paused_count;
+    }
+    void setCaptureCompare(uint32_t channel, uint32_t compare, TimerCompareFormat_t format = TICK_COMPARE_FORMAT)
+    {
+        (void)(channel);
+        (void)(format);
+        this->compare = compare;
+        scheduleInterrupt();
+    }
+    void resume()
+    {
+        if (!running)
+        {
+            start = shim::now_us - paused_count;
+            running = true;
+            scheduleInterrupt();
+        }
+    }
+    void pause()
+    {
+        if (running)
+        {
+            paused_count = getCount();
+            running = false;
+        }
+    }
+
+    // the last constructed timer, the firmware only uses one
+    static inline HardwareTimer *active = nullptr;
+    bool running = false;
+    uint32_t overflow = 0x10000;
+    // time of the next compare match and the number of compare interrupts taken so far
+    unsigned long next_interrupt = 0;
+    unsigned long interrupt_count = 0;
+    callback_function_t callback = nullptr;
+
+private:
+    unsigned long start = 0;
+    uint32_t paused_count = 0;
+    uint32_t compare = 0;
+
+    // the counter matches the compare value again only after wrapping around if it is there already
+    void scheduleInterrupt()
+    {
+        uint32_t until = (compare + overflow - getCount()) % overflow;
+        next_interrupt = shim::now_us + (until ? until : overflow);
+    }
+};
+
+inline void shimAdvanceTo(unsigned long time)
+{
+    HardwareTimer *timer = HardwareTimer::active;
+    while (shim::interrupts_enabled && timer && timer->running && timer->callback && (long)(time - timer->next_interrupt) >= 0)
+    {
+        if ((long)(shim::now_us - timer->next_interrupt) < 0)
+            shim::now_us = timer->next_interrupt;
+        timer->next_interrupt += timer->overflow;
+        timer->interrupt_count++;
+        // the handler runs with interrupts disabled, like an isr
+        shim::interrupts_enabled = false;
+        timer->callback();
+        shim::interrupts_enabled = true;
+    }
+    if ((long)(time - shim::now_us) > 0)
+        shim::now_us = time;
+}
+
+inline void __WFI()
+{
+    unsigned long wake_up = (shim::now_us / 1000 + 1) * 1000;
+    HardwareTimer *timer = HardwareTimer::active;
+    if (timer && timer->running && timer->callback && (long)(timer->next_interrupt - wake_up) < 0)
+        wake_up = timer->next_interrupt;
+    if ((long)(wake_up - shim::now_us) > 0)
+        shim::now_us = wake_up;
+}
+
+#pragma endregion
+
+#pragma region serial
+
+struct ShimSerial
+{
+    void begin(unsigned long baud) { (void)(baud); }
+    template <typename T> size_t print(T value) { (void)(value); return 0; }
+    template <typename T> size_t print(T value, int format) { (void)(value); (void)(format); return 0; }
+    template <typename T> size_t println(T value) { (void)(value); return 0; }
+    size_t println() { return 0; }
+};
+inline ShimSerial Serial;
+
+#pragma endregion
@@ -0,0 +1,86 @@
+#pragma once
+
+// host stand-in for the i2c slave side of Wire, a test hands a received write to the firmware with receive()
+// and reads what the firmware answers to a read request with request()
+
+#include <Arduino.h>
+
+#define SHIM_WIRE_BUFFER_LENGTH 32
+
+class TwoWire
+{
+public:
+    void setSCL(uint32_t pin) { (void)(pin); }
+    void setSDA(uint32_t pin) { (void)(pin); }
+    void begin(uint8_t address) { this->address = address; }
+    void onReceive(void (*handler)(int)) { receive_handler = handler; }
+    void onRequest(void (*handler)(void)) { request_handler = handler; }
+
+    int available() { return rx_length - rx_index; }
+    int peek() { return rx_index < rx_length ? rx_buffer[rx_index] : -1; }
+    int read() { return rx_index < rx_length ? rx_buffer[rx_index++] : -1; }
+    size_t readBytes(uint8_t *buffer, size_t length)
+    {
+        size_t count = 0;
+        while (count < length && rx_index < rx_length)
+            buffer[count++] = rx_buffer[rx_index++];
+        return count;
+    }
+    size_t write(uint8_t data)
+    {
+        if (tx_length >= SHIM_WIRE_BUFFER_LENGTH)
+            return 0;
+        tx_buffer[tx_length++] = data;
+        return 1;
+    }
+    size_t write(const uint8_t *data, size_t length)
+    {
+        size_t count = 0;
+        while (count < length && write(data[count]))
+            count++;
+        return count;
+    }
+
+    // a write from the master, the receive handler runs like the i2c interrupt
+    void receive(const uint8_t *data, uint8_t length)
+    {
+        length = min<uint8_t>(length, SHIM_WIRE_BUFFER_LENGTH);
+        memcpy(rx_buffer, data, length);
+        rx_length = length;
+        rx_index = 0;
+        if (receive_handler)
+            runAsInterrupt([this] { receive_handler(rx_length); });
+    }
+
+    // a read from the master, returns the number of bytes the request handler wrote to buffer
+    uint8_t request(uint8_t *buffer, uint8_t length)
+    {
+        tx_length = 0;
+        if (request_handler)
+            runAsInterrupt([this] { request_handler(); });
+        length = min(length, tx_length);
+        memcpy(buffer, tx_buffer, length);
+        return length;
+    }
+
+    uint8_t address = 0;
+
+private:
+    template <typename Handler> void runAsInterrupt(Handler handler)
+    {
+        bool enabled = shim::interrupts_enabled;
+        shim::interrupts_enabled = false;
+        handler();
+        shim::interrupts_enabled = enabled;
+    }
+
+    void (*receive_handler)(int) = nullptr;
+    void (*request_handler)(void) = nullptr;
+    uint8_t rx_buffer[SHIM_WIRE_BUFFER_LENGTH];
+    uint8_t rx_length = 0;
+    uint8_t rx_index = 0;
+    uint8_t tx_buffer[SHIM_WIRE_BUFFER_LENGTH];
+    uint8_t tx_length = 0;
+};
+
+inline TwoWire Wire;
@@ -0,0 +1,147 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <thread>
+#include "config.h"
+#include "command_queue.h"
+
+// the i2c interrupt and loop() share the command queue without locking, here a producer thread stands in for the
+// interrupt and receives batches of commands while the consumer thread peeks and pops them like the executor does,
+// every command has to arrive once, in order and complete
+
+#define STRESS_COMMANDS 2000000UL
+#define MAX_BATCH 4
+
+CommandQueue queue;
+
+// the contents of command number seq, every byte depends on it so a torn or reused slot shows up
+void fillCommand(CommandData *command, uint32_t seq)
+{
+    command->bufferLength = 1 + seq % MAX_COMMAND_LENGTH;
+    for (uint8_t i = 0; i < MAX_COMMAND_LENGTH; i++)
+    {
+        command->buffer[i] = (byte)(seq * 31 + i);
+    }
+}
+
+bool commandMatches(const CommandData *command, uint32_t seq)
+{
+    if (command->bufferLength != 1 + seq % MAX_COMMAND_LENGTH)
+        return false;
+    for (uint8_t i = 0; i < MAX_COMMAND_LENGTH; i++)
+    {
+        if (command->buffer[i] != (byte)(seq * 31 + i))
+            return false;
+    }
+    return true;
+}
+
+void produce()
+{
+    uint32_t seq = 0;
+    uint8_t batch = 1;
+    while (seq < STRESS_COMMANDS)
+    {
+        // like a batch packet, all slots are received before any of them is committed
+        uint8_t count = 0;
+        while (count < batch && seq + count < STRESS_COMMANDS)
+        {
+            CommandData *command = queue.reserveCommand(count);
+            if (command == nullptr)
+                break;
+            fillCommand(command, seq + count);
+            count++;
+        }
+        if (count == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        queue.commitCommands(count);
+        seq += count;
+        batch = 1 + seq % MAX_BATCH;
+    }
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_empty_and_full()
+{
+    TEST_ASSERT_TRUE(queue.isEmpty());
+    TEST_ASSERT_NULL(queue.peekCommand());
+    for (uint16_t i = 0; i < CMD_QUEUE_LENGTH; i++)
+    {
+        CommandData *command = queue.reserveCommand();
+        TEST_ASSERT_NOT_NULL(command);
+        fillCommand(command, i);
+        queue.commitCommands();
+    }
+    // a full queue hands out no slot, neither the next one nor one reserved further ahead
+    TEST_ASSERT_NULL(queue.reserveCommand());
+    TEST_ASSERT_NULL(queue.reserveCommand(MAX_BATCH));
+    for (uint16_t i = 0; i < CMD_QUEUE_LENGTH; i++)
+    {
+        CommandData *command = queue.peekCommand();
+        TEST_ASSERT_NOT_NULL(command);
+        TEST_ASSERT_TRUE(commandMatches(command, i));
+        queue.popCommand();
+    }
+    TEST_ASSERT_TRUE(queue.isEmpty());
+}
+
+void test_reserved_slots_stay_hidden()
+{
+    // received but not yet committed commands are not visible to the consumer
+    for (uint8_t i = 0; i < MAX_BATCH; i++)
+    {
+        fillCommand(queue.reserveCommand(i), i);
+    }
+    TEST_ASSERT_NULL(queue.peekCommand());
+    queue.commitCommands(MAX_BATCH);
+    for (uint8_t i = 0; i < MAX_BATCH; i++)
+    {
+        TEST_ASSERT_TRUE(commandMatches(queue.peekCommand(), i));
+        queue.popCommand();
+    }
+    TEST_ASSERT_TRUE(queue.isEmpty());
+}
+
+void test_producer_consumer_stress()
+{
+    std::thread producer(produce);
+    uint32_t received = 0;
+    uint32_t corrupted = 0;
+    while (received < STRESS_COMMANDS)
+    {
+        CommandData *command = queue.peekCommand();
+        if (command == nullptr)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        if (!commandMatches(command, received))
+            corrupted++;
+        queue.popCommand();
+        received++;
+    }
+    producer.join();
+
+    TEST_ASSERT_EQUAL(0, corrupted);
+    TEST_ASSERT_TRUE(queue.isEmpty());
+}
+
+int main(int argc, char **argv)
+{
+    (void)(argc);
+    (void)(argv);
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_and_full);
+    RUN_TEST(test_reserved_slots_stay_hidden);
+    RUN_TEST(test_producer_consumer_stress);
+    return UNITY_END();
+}
@@ -0,0 +1,407 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include <unity.h>
+#include <initializer_list>
+#include <vector>
+#include "config.h"
+#include "steppers.h"
+#include "step_engine.h"
+#include "packet_handlers.h"
+#include "command_queue.h"
+#include "command_executor.h"
+
+// sends commands the way the master does, as i2c writes to the firmware running on the simulated clock of the shim,
+// and checks what they do to the steppers and what the master reads back
+
+void setup();
+void loop();
+extern CommandQueue i2c_cmd_queue;
+extern volatile uint16_t command_queue_overflows;
+
+// a command with its checksum filled in, sent as a write of the master
+template <typename T>
+void sendCommand(T data)
+{
+    byte *buffer = reinterpret_cast<byte *>(&data);
+    data.checksum = 0;
+    for (uint8_t i = 0; i < sizeof(T) - 1; i++)
+    {
+        data.checksum += buffer[i];
+    }
+    Wire.receive(buffer, sizeof(T));
+}
+
+// a command with a payload after its datastruct, given as its bytes without the checksum
+void sendBytes(std::initializer_list<byte> bytes)
+{
+    byte buffer[SHIM_WIRE_BUFFER_LENGTH];
+    uint8_t length = 0;
+    uint8_t checksum = 0;
+    for (byte b : bytes)
+    {
+        checksum += b;
+        buffer[length++] = b;
+    }
+    buffer[length++] = checksum;
+    Wire.receive(buffer, length);
+}
+
+// a batch frame of the given commands, each without its checksum
+std::vector<byte> batchFrame(std::initializer_list<std::initializer_list<byte>> commands)
+{
+    std::vector<byte> frame = {BATCH_FRAME_ID};
+    uint8_t frame_checksum = BATCH_FRAME_ID;
+    for (auto command : commands)
+    {
+        uint8_t checksum = 0;
+        frame.push_back(command.size());
+        for (byte b : command)
+        {
+            checksum += b;
+            frame.push_back(b);
+        }
+        frame_checksum += command.size() + checksum;
+    }
+    frame.push_back(frame_checksum);
+    return frame;
+}
+
+void sendFrame(const std::vector<byte> &frame)
+{
+    Wire.receive(frame.data(), frame.size());
+}
+
+// executes what was sent, without letting time pass
+void executeSent()
+{
+    loop();
+}
+
+void runUntilIdle()
+{
+    unsigned long timeout = micros() + 60000000UL;
+    while (!stepEngineIdle() && (long)(micros() - timeout) < 0)
+    {
+        loop();
+    }
+}
+
+// reads the running bitmap and the query reply after it, returns the number of bytes read
+uint8_t readStatus(byte *buffer)
+{
+    return Wire.request(buffer, SHIM_WIRE_BUFFER_LENGTH);
+}
+
+uint32_t littleEndian(const byte *buffer, uint8_t size)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < size; i++)
+    {
+        value |= (uint32_t)buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+uint16_t replyValue(const byte *buffer, uint8_t index)
+{
+    // after the bitmap and the query id
+    return littleEndian(buffer + 2 + 2 * index, 2);
+}
+
+struct DrainReply
+{
+    uint16_t budget;
+    CommandDrainStats stats;
+};
+
+DrainReply queryDrainStats()
+{
+    sendCommand(query_datastruct{query, query_drain_stats, selector_all, 0});
+    executeSent();
+    byte status[SHIM_WIRE_BUFFER_LENGTH];
+    TEST_ASSERT_EQUAL(1 + 1 + 16, readStatus(status));
+    TEST_ASSERT_EQUAL(query_drain_stats, status[1]);
+    DrainReply reply;
+    reply.budget = littleEndian(status + 2, 2);
+    reply.stats.commands = littleEndian(status + 4, 4);
+    reply.stats.passes = littleEndian(status + 8, 4);
+    reply.stats.max_per_pass = littleEndian(status + 12, 2);
+    reply.stats.budget_exhausted = littleEndian(status + 14, 4);
+    return reply;
+}
+
+void setUp(void)
+{
+    runUntilIdle();
+}
+
+void tearDown(void)
+{
+}
+
+void test_query_time_to_target()
+{
+    sendCommand(move_datastruct{move, 1000, 1, x3m, 0});
+    sendCommand(query_datastruct{query, query_time_to_target, x3m, 0});
+    executeSent();
+    unsigned long queried = micros();
+
+    byte status[SHIM_WIRE_BUFFER_LENGTH];
+    TEST_ASSERT_EQUAL(4, readStatus(status));
+    TEST_ASSERT_EQUAL(1 << x3m, status[0]);
+    TEST_ASSERT_EQUAL(query_time_to_target, status[1]);
+    float planned = replyValue(status, 0) / 1000.0;
+
+    runUntilIdle();
+    float actual = (micros() - queried) / 1000000.0;
+    TEST_ASSERT_FLOAT_WITHIN(0.02 * actual + 0.05, actual, planned);
+}
+
+void test_query_selected_steppers_at_rest()
+{
+    sendCommand(query_datastruct{query, query_time_to_target, selector_hour, 0});
+    executeSent();
+
+    byte status[SHIM_WIRE_BUFFER_LENGTH];
+    TEST_ASSERT_EQUAL(2 + 2 * 4, readStatus(status));
+    TEST_ASSERT_EQUAL(0, status[0]);
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_EQUAL(0, replyValue(status, i));
+    }
+}
+
+void test_query_answered_once_executed()
+{
+    sendCommand(query_datastruct{query, query_none, selector_all, 0});
+    executeSent();
+    byte status[SHIM_WIRE_BUFFER_LENGTH];
+    TEST_ASSERT_EQUAL(2, readStatus(status));
+    TEST_ASSERT_EQUAL(query_none, status[1]);
+
+    // still queued, the master gets the previous answer
+    sendCommand(query_datastruct{query, query_time_to_target, selector_all, 0});
+    TEST_ASSERT_EQUAL(query_none, status[1]);
+    executeSent();
+    TEST_ASSERT_EQUAL(2 + 2 * NUM_STEPPERS, readStatus(status));
+    TEST_ASSERT_EQUAL(query_time_to_target, status[1]);
+}
+
+void test_drain_stats_query()
+{
+    queryDrainStats();
+    // counted from the pass of the previous query on
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        sendCommand(set_speed_datastruct{set_speed, STEPPER_DEFAULT_SPEED, selector_all, 0});
+    }
+    executeSent();
+
+    DrainReply reply = queryDrainStats();
+    TEST_ASSERT_EQUAL(COMMAND_DRAIN_BUDGET_US, reply.budget);
+    TEST_ASSERT_EQUAL(1 + 5, reply.stats.commands);
+    TEST_ASSERT_EQUAL(2, reply.stats.passes);
+    TEST_ASSERT_EQUAL(5, reply.stats.max_per_pass);
+    TEST_ASSERT_EQUAL(0, reply.stats.budget_exhausted);
+}
+
+void test_set_drain_budget()
+{
+    // without a budget each pass executes a single command
+    sendCommand(set_drain_budget_datastruct{set_drain_budget, 0, 0});
+    executeSent();
+    queryDrainStats();
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        sendCommand(set_speed_datastruct{set_speed, STEPPER_DEFAULT_SPEED, selector_all, 0});
+    }
+    executeSent();
+    TEST_ASSERT_FALSE(i2c_cmd_queue.isEmpty());
+    executeSent();
+    executeSent();
+    TEST_ASSERT_TRUE(i2c_cmd_queue.isEmpty());
+
+    DrainReply reply = queryDrainStats();
+    TEST_ASSERT_EQUAL(0, reply.budget);
+    TEST_ASSERT_EQUAL(1 + 3, reply.stats.commands);
+    TEST_ASSERT_EQUAL(4, reply.stats.passes);
+    TEST_ASSERT_EQUAL(1, reply.stats.max_per_pass);
+    TEST_ASSERT_EQUAL(2, reply.stats.budget_exhausted);
+
+    sendCommand(set_drain_budget_datastruct{set_drain_budget, MAX_COMMAND_DRAIN_BUDGET_US + 1, 0});
+    executeSent();
+    TEST_ASSERT_EQUAL(0, queryDrainStats().budget);
+
+    sendCommand(set_drain_budget_datastruct{set_drain_budget, COMMAND_DRAIN_BUDGET_US, 0});
+    executeSent();
+    TEST_ASSERT_EQUAL(COMMAND_DRAIN_BUDGET_US, queryDrainStats().budget);
+}
+
+// the position of a stepper at rest, wrapped into one revolution like the steppers do before a move
+long restPosition(uint8_t stepper)
+{
+    return (stepper_bank[stepper].currentPosition() % STEPS_PER_REVOLUTION + STEPS_PER_REVOLUTION) % STEPS_PER_REVOLUTION;
+}
+
+// executes what was sent and checks how far it moved the target of each stepper, the steppers start at rest
+// a moved stepper may take its first step right away
+void executeAndAssertMoves(std::initializer_list<long> distances)
+{
+    long start[NUM_STEPPERS];
+    for (uint8_t i = 0; i < NUM_STEPPERS; i++)
+    {
+        start[i] = restPosition(i);
+    }
+    executeSent();
+    uint8_t i = 0;
+    for (long distance : distances)
+    {
+        if (distance == 0)
+            TEST_ASSERT_EQUAL(0, stepper_bank[i].distanceToGo());
+        else
+            TEST_ASSERT_EQUAL(distance, stepper_bank[i].targetPosition() - start[i]);
+        i++;
+    }
+}
+
+void test_keyframe_one_byte_deltas()
+{
+    sendBytes({keyframe, 0b00001011, 0x00, 0x3F, 0x40});
+    executeAndAssertMoves({0, 63, 0, -64, 0, 0, 0, 0});
+}
+
+void test_keyframe_two_byte_deltas()
+{
+    // 15 bit two's complement, big endian, with the high bit of the first byte set
+    sendBytes({keyframe, 0b00110000, 0x80, 0x40, 0xFF, 0xBF});
+    executeAndAssertMoves({0, 0, 0, 0, 64, -65, 0, 0});
+}
+
+void test_keyframe_delta_bounds()
+{
+    // mixed lengths, in order of the stepper id
+    sendBytes({keyframe, 0b11000001, 0x7F, 0xBF, 0xFF, 0xC0, 0x00});
+    executeAndAssertMoves({-1, 0, 0, 0, 0, 0, 16383, -16384});
+}
+
+void test_keyframe_wrong_payload_length_rejected()
+{
+    sendBytes({keyframe, 0b00000011, 0x01}); // a delta missing
+    sendBytes({keyframe, 0b00000001, 0x80}); // a 2 byte delta cut off
+    sendBytes({keyframe, 0b00000001, 0x01, 0x01}); // a delta too many
+    sendBytes({keyframe, 0b00000000, 0x01});
+    executeAndAssertMoves({0, 0, 0, 0, 0, 0, 0, 0});
+}
+
+void test_batch_frame()
+{
+    sendFrame(batchFrame({{keyframe, 0b00000001, 0x10}, {keyframe, 0b00000010, 0x20}}));
+    executeAndAssertMoves({16, 32, 0, 0, 0, 0, 0, 0});
+}
+
+void test_batch_frame_length_overrun_rejected()
+{
+    std::vector<byte> frame = batchFrame({{keyframe, 0b00000001, 0x10}, {keyframe, 0b00000010, 0x20}});
+    frame[5] = 4; // the second command claims a byte more than is left before the frame checksum
+    sendFrame(frame);
+    TEST_ASSERT_TRUE(i2c_cmd_queue.isEmpty());
+    executeAndAssertMoves({0, 0, 0, 0, 0, 0, 0, 0});
+}
+
+void test_batch_frame_bad_checksum_rejected()
+{
+    std::vector<byte> frame = batchFrame({{keyframe, 0b00000001, 0x10}, {keyframe, 0b00000010, 0x20}});
+    frame.back()++;
+    sendFrame(frame);
+    TEST_ASSERT_TRUE(i2c_cmd_queue.isEmpty());
+    executeAndAssertMoves({0, 0, 0, 0, 0, 0, 0, 0});
+}
+
+void test_batch_frame_dropped_without_room_for_all()
+{
+    // leave room for one command of the frame only
+    for (uint16_t i = 0; i < CMD_QUEUE_LENGTH - 1; i++)
+    {
+        sendCommand(set_speed_datastruct{set_speed, STEPPER_DEFAULT_SPEED, selector_all, 0});
+    }
+    uint16_t overflows = command_queue_overflows;
+    sendFrame(batchFrame({{keyframe, 0b00000001, 0x10}, {keyframe, 0b00000010, 0x20}}));
+    TEST_ASSERT_EQUAL(overflows + 1, command_queue_overflows);
+
+    while (!i2c_cmd_queue.isEmpty())
+    {
+        executeSent();
+    }
+    executeAndAssertMoves({0, 0, 0, 0, 0, 0, 0, 0});
+}
+
+void test_masked_selection()
+{
+    // with SELECTOR_MASK_FLAG the stepper_id is a bitmask, here of steppers 0, 2, 5 and 7
+    sendCommand(move_datastruct{move | SELECTOR_MASK_FLAG, 100, 1, (int8_t)0xA5, 0});
+    executeAndAssertMoves({100, 0, 100, 0, 0, 100, 0, 100});
+}
+
+// a moveTo_all to the given offsets from where the steppers are
+moveTo_all_datastruct moveToAllOffsets(std::initializer_list<long> offsets, uint8_t cw_mask, uint8_t ccw_mask, uint8_t extra_revs)
+{
+    moveTo_all_datastruct data = {moveTo_all, {}, cw_mask, ccw_mask, extra_revs, 0};
+    uint8_t i = 0;
+    for (long offset : offsets)
+    {
+        data.positions[i] = (restPosition(i) + offset + STEPS_PER_REVOLUTION) % STEPS_PER_REVOLUTION;
+        i++;
+    }
+    return data;
+}
+
+void test_moveTo_all_directions()
+{
+    // 0 and 1 cw, 2 and 3 ccw, the others the shortest path
+    sendCommand(moveToAllOffsets({100, -100, 100, -100, 100, -100, 3000, 0}, 0b00000011, 0b00001100, 0));
+    executeAndAssertMoves({100, STEPS_PER_REVOLUTION - 100, 100 - STEPS_PER_REVOLUTION, -100, 100, -100, 3000 - STEPS_PER_REVOLUTION, 0});
+}
+
+void test_moveTo_all_extra_revs()
+{
+    sendCommand(moveToAllOffsets({100, 100, 100, 100, 100, 100, 100, 100}, 0b00001111, 0b11110000, 1));
+    long cw = 100 + STEPS_PER_REVOLUTION;
+    long ccw = 100 - 2 * STEPS_PER_REVOLUTION;
+    executeAndAssertMoves({cw, cw, cw, cw, ccw, ccw, ccw, ccw});
+}
+
+void test_moveTo_all_invalid_masks_rejected()
+{
+    // a stepper in both masks
+    sendCommand(moveToAllOffsets({100, 100, 100, 100, 100, 100, 100, 100}, 0b00000001, 0b00000001, 0));
+    // extra revs for a stepper without a direction
+    sendCommand(moveToAllOffsets({100, 100, 100, 100, 100, 100, 100, 100}, 0b01111111, 0b00000000, 1));
+    executeAndAssertMoves({0, 0, 0, 0, 0, 0, 0, 0});
+}
+
+int main(int argc, char **argv)
+{
+    (void)(argc);
+    (void)(argv);
+    setup();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_query_time_to_target);
+    RUN_TEST(test_query_selected_steppers_at_rest);
+    RUN_TEST(test_query_answered_once_executed);
+    RUN_TEST(test_drain_stats_query);
+    RUN_TEST(test_set_drain_budget);
+    RUN_TEST(test_keyframe_one_byte_deltas);
+    RUN_TEST(test_keyframe_two_byte_deltas);
+    RUN_TEST(test_keyframe_delta_bounds);
+    RUN_TEST(test_keyframe_wrong_payload_length_rejected);
+    RUN_TEST(test_batch_frame);
+    RUN_TEST(test_batch_frame_length_overrun_rejected);
+    RUN_TEST(test_batch_frame_bad_checksum_rejected);
+    RUN_TEST(test_batch_frame_dropped_without_room_for_all);
+    RUN_TEST(test_masked_selection);
+    RUN_TEST(test_moveTo_all_directions);
+    RUN_TEST(test_moveTo_all_extra_revs);
+    RUN_TEST(test_moveTo_all_invalid_masks_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,116 @@
+#include <Arduino.h>
+#include <AccelStepper.h>
+#include <unity.h>
+#include <vector>
+#include "config.h"
+
+// checks the Q24.8 ramp of ACCELSTEPPER_FIXED_POINT against the float implementation of Equation 13 it replaces,
+// over the range of accelerations the set_accel command accepts
+
+#define STEP_PIN 48
+#define DIR_PIN 49
+#define RAMP_STEPS 400 // stays below the max speed for all accelerations
+#define ACCEL_CHECKS 101
+
+#if !ACCELSTEPPER_FIXED_POINT
+  #error "the test checks the fixed point ramp, build it with ACCELSTEPPER_FIXED_POINT"
+#endif
+
+// times of the first steps from rest, relative to the first one
+std::vector<unsigned long> fixedPointRampSteps(AccelStepper &stepper)
+{
+    std::vector<unsigned long> steps;
+    unsigned long start = 0;
+    unsigned long now = 1000000000UL; // long after the last step of the stepper, so the first step is taken right away
+    stepper.setMaxSpeed(MAX_SPEED * 10);
+    stepper.setCurrentPosition(0);
+    stepper.moveTo(RAMP_STEPS * 2);
+    while (steps.size() < RAMP_STEPS)
+    {
+        now = stepper.nextRunTime(now);
+        long position = stepper.currentPosition();
+        stepper.run(now);
+        if (stepper.currentPosition() != position)
+        {
+            if (steps.empty())
+                start = now;
+            steps.push_back(now - start);
+        }
+    }
+    return steps;
+}
+
+// the same steps as the float implementation takes them, the interval truncated to microseconds like _stepInterval
+// the first step from rest is taken right away, so the interval before the second step already is c1
+std::vector<unsigned long> floatRampSteps(float acceleration)
+{
+    std::vector<unsigned long> steps;
+    float cn = 0.676 * sqrt(2.0 / acceleration) * 1000000.0; // Equation 15
+    unsigned long time = 0;
+    steps.push_back(time);
+    for (long n = 1; n < RAMP_STEPS; n++)
+    {
+        cn = cn - ((2.0 * cn) / ((4.0 * n) + 1)); // Equation 13
+        time += (unsigned long)cn;
+        steps.push_back(time);
+    }
+    return steps;
+}
+
+float checkedAcceleration(uint8_t i)
+{
+    return MIN_ACCEL + (MAX_ACCEL - MIN_ACCEL) * (float)i / (ACCEL_CHECKS - 1);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_ramp_matches_float()
+{
+    for (uint8_t i = 0; i < ACCEL_CHECKS; i++)
+    {
+        float acceleration = checkedAcceleration(i);
+        AccelStepper stepper(STEP_PIN, DIR_PIN, STEPS_PER_REVOLUTION);
+        stepper.setAcceleration(acceleration);
+
+        std::vector<unsigned long> fixed_steps = fixedPointRampSteps(stepper);
+        std::vector<unsigned long> float_steps = floatRampSteps(acceleration);
+        for (size_t n = 1; n < RAMP_STEPS; n++)
+        {
+            // the fractional microseconds carried by Q24.8 only shift a step by a few microseconds
+            long deviation = (long)(fixed_steps[n] - float_steps[n]);
+            TEST_ASSERT_INT_WITHIN_MESSAGE(2 + float_steps[n] / 100000, 0, deviation, "step time off the float ramp");
+        }
+    }
+}
+
+void test_shared_c0_gives_same_ramp()
+{
+    // executeSetAccel computes c0 once and hands it to the other selected steppers
+    for (uint8_t i = 0; i < ACCEL_CHECKS; i++)
+    {
+        float acceleration = checkedAcceleration(i);
+        AccelStepper first(STEP_PIN, DIR_PIN, STEPS_PER_REVOLUTION);
+        AccelStepper other(STEP_PIN, DIR_PIN, STEPS_PER_REVOLUTION);
+        ramp_t c0 = first.setAcceleration(acceleration);
+        other.setAcceleration(acceleration, c0);
+
+        TEST_ASSERT_EQUAL_INT32(c0, other.setAcceleration(acceleration));
+        TEST_ASSERT_TRUE(fixedPointRampSteps(first) == fixedPointRampSteps(other));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    (void)(argc);
+    (void)(argv);
+    UNITY_BEGIN();
+    RUN_TEST(test_ramp_matches_float);
+    RUN_TEST(test_shared_c0_gives_same_ramp);
+    return UNITY_END();
+}
@@ -0,0 +1,137 @@
+#include <Arduino.h>
+#include <AccelStepper.h>
+#include <unity.h>
+#include <vector>
+#include "config.h"
+
+// runs a stepper that takes its steps from planSteps() next to one that computes every step with computeNewSpeed(),
+// both have to take exactly the same steps at exactly the same times
+
+#define STEP_PIN 48
+#define DIR_PIN 49
+
+struct StepRecord
+{
+    unsigned long time;
+    long position;
+    float speed;
+
+    bool operator==(const StepRecord &other) const
+    {
+        return time == other.time && position == other.position && speed == other.speed;
+    }
+};
+
+// a change made between two steps, like a command executed by the loop
+struct MoveChange
+{
+    size_t after_step;
+    long target;
+    float max_speed;
+    float acceleration;
+};
+
+void configure(AccelStepper &stepper, AccelStepper::Profile profile)
+{
+    stepper.setProfile(profile);
+    stepper.setMaxSpeed(STEPPER_DEFAULT_SPEED);
+    stepper.setAcceleration(STEPPER_DEFAULT_ACCEL);
+    stepper.setJerk(STEPPER_DEFAULT_JERK);
+    stepper.setCurrentPosition(0);
+}
+
+// runs the move to target, with plan_every planSteps() is called after every plan_every steps, 0 never plans
+std::vector<StepRecord> runMove(AccelStepper::Profile profile, long target, uint8_t plan_every, const std::vector<MoveChange> &changes)
+{
+    AccelStepper stepper(STEP_PIN, DIR_PIN, STEPS_PER_REVOLUTION);
+    configure(stepper, profile);
+    stepper.moveTo(target);
+
+    std::vector<StepRecord> steps;
+    size_t next_change = 0;
+    unsigned long now = 1000000000UL;
+    while (stepper.isScheduled() && steps.size() < 100000)
+    {
+        if (plan_every && steps.size() % plan_every == 0)
+        {
+            // the ring is filled up to one free slot, unless the move ends before
+            uint8_t buffered = stepper.planSteps();
+            if (labs(stepper.distanceToGo()) >= ACCELSTEPPER_PLAN_LENGTH)
+                TEST_ASSERT_EQUAL(ACCELSTEPPER_PLAN_LENGTH - 1, buffered);
+        }
+
+        now = stepper.nextRunTime(now);
+        long position = stepper.currentPosition();
+        stepper.run(now);
+        if (stepper.currentPosition() == position)
+            continue;
+        steps.push_back({now, stepper.currentPosition(), stepper.speed()});
+
+        if (next_change < changes.size() && changes[next_change].after_step == steps.size())
+        {
+            const MoveChange &change = changes[next_change++];
+            stepper.moveTo(change.target);
+            stepper.setMaxSpeed(change.max_speed);
+            stepper.setAcceleration(change.acceleration);
+        }
+    }
+    TEST_ASSERT_FALSE(stepper.isScheduled());
+    return steps;
+}
+
+void assertPlanMatchesComputed(AccelStepper::Profile profile, long target, const std::vector<MoveChange> &changes)
+{
+    std::vector<StepRecord> computed = runMove(profile, target, 0, changes);
+    TEST_ASSERT_GREATER_THAN(0, computed.size());
+    // planning after every step keeps the ring full, less often it runs empty and run() computes some steps itself
+    for (uint8_t plan_every : {1, 3, ACCELSTEPPER_PLAN_LENGTH + 2})
+    {
+        std::vector<StepRecord> planned = runMove(profile, target, plan_every, changes);
+        TEST_ASSERT_EQUAL(computed.size(), planned.size());
+        for (size_t i = 0; i < computed.size(); i++)
+        {
+            TEST_ASSERT_TRUE_MESSAGE(computed[i] == planned[i], "planned step differs from the computed one");
+        }
+    }
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_trapezoidal_move()
+{
+    assertPlanMatchesComputed(AccelStepper::PROFILE_TRAPEZOIDAL, STEPS_PER_REVOLUTION, {});
+}
+
+void test_s_curve_move()
+{
+    assertPlanMatchesComputed(AccelStepper::PROFILE_SCURVE, -STEPS_PER_REVOLUTION, {});
+}
+
+void test_changes_during_move()
+{
+    // retargeting, reversing and changing the ramp invalidate what is planned
+    std::vector<MoveChange> changes = {
+        {200, 3000, STEPPER_DEFAULT_SPEED, STEPPER_DEFAULT_ACCEL},
+        {700, 3000, 400, 150},
+        {1200, -500, MAX_SPEED, MAX_ACCEL},
+    };
+    assertPlanMatchesComputed(AccelStepper::PROFILE_TRAPEZOIDAL, 2000, changes);
+    assertPlanMatchesComputed(AccelStepper::PROFILE_SCURVE, 2000, changes);
+}
+
+int main(int argc, char **argv)
+{
+    (void)(argc);
+    (void)(argv);
+    UNITY_BEGIN();
+    RUN_TEST(test_trapezoidal_move);
+    RUN_TEST(test_s_curve_move);
+    RUN_TEST(test_changes_during_move);
+    return UNITY_END();
+}
@@ -0,0 +1,140 @@
+#include <Arduino.h>
+#include <AccelStepper.h>
+#include <unity.h>
+#include <vector>
+#include "config.h"
+
+// runs s-curve moves of all lengths from rest and checks the speed and acceleration derived from the step times:
+// the speed changes continuously, the acceleration stays within the set one and only changes at the set jerk,
+// also for moves too short to reach max speed, which used to flip from +a to -a halfway
+
+#define STEP_PIN 48
+#define DIR_PIN 49
+#define WINDOWS 30 // the acceleration and jerk are measured over a 30th of the move, to average out the step quantization
+#define JERK_TOLERANCE 1.3
+#define ACCEL_TOLERANCE 1.1
+
+const long distances[] = {20, 60, 200, 500, 1000, 1500, 1700, 1800, 3000};
+
+void configure(AccelStepper &stepper)
+{
+    stepper.setProfile(AccelStepper::PROFILE_SCURVE);
+    stepper.setMaxSpeed(STEPPER_DEFAULT_SPEED);
+    stepper.setAcceleration(STEPPER_DEFAULT_ACCEL);
+    stepper.setJerk(STEPPER_DEFAULT_JERK);
+    stepper.setCurrentPosition(0);
+}
+
+// times of all steps of a move from rest in seconds, relative to the first one
+std::vector<double> stepTimes(long distance)
+{
+    AccelStepper stepper(STEP_PIN, DIR_PIN, STEPS_PER_REVOLUTION);
+    configure(stepper);
+    stepper.moveTo(distance);
+
+    std::vector<double> times;
+    unsigned long start = 1000000000UL;
+    unsigned long now = start;
+    while (stepper.isScheduled() && times.size() < 100000)
+    {
+        now = stepper.nextRunTime(now);
+        long position = stepper.currentPosition();
+        stepper.run(now);
+        if (stepper.currentPosition() != position)
+            times.push_back((now - start) / 1000000.0);
+    }
+    TEST_ASSERT_EQUAL(distance, stepper.currentPosition());
+    TEST_ASSERT_EQUAL(0, stepper.distanceToGo());
+    return times;
+}
+
+// derivative of values sampled at times
+void derive(const std::vector<double> &times, const std::vector<double> &values, std::vector<double> &derived_times, std::vector<double> &derived)
+{
+    derived_times.clear();
+    derived.clear();
+    for (size_t i = 0; i + 1 < values.size(); i++)
+    {
+        derived.push_back((values[i + 1] - values[i]) / (times[i + 1] - times[i]));
+        derived_times.push_back((times[i + 1] + times[i]) / 2.0);
+    }
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_speed_continuous()
+{
+    // the speed between two steps changes by no more than the set acceleration allows over the two intervals
+    for (long distance : distances)
+    {
+        std::vector<double> times = stepTimes(distance);
+        for (size_t i = 1; i + 1 < times.size(); i++)
+        {
+            double before = times[i] - times[i - 1];
+            double after = times[i + 1] - times[i];
+            double change = fabs(1.0 / after - 1.0 / before);
+            TEST_ASSERT_TRUE_MESSAGE(change <= ACCEL_TOLERANCE * STEPPER_DEFAULT_ACCEL * (before + after), "speed jumps between steps");
+        }
+    }
+}
+
+void test_acceleration_and_jerk_limited()
+{
+    for (long distance : distances)
+    {
+        std::vector<double> times = stepTimes(distance);
+        size_t window = max((size_t)1, times.size() / WINDOWS);
+
+        // the speed over each window, taken at its middle
+        std::vector<double> speed_times, speeds;
+        for (size_t i = 0; i + window < times.size(); i += window)
+        {
+            speeds.push_back(window / (times[i + window] - times[i]));
+            speed_times.push_back((times[i + window] + times[i]) / 2.0);
+        }
+        std::vector<double> accel_times, accels, jerk_times, jerks;
+        derive(speed_times, speeds, accel_times, accels);
+        derive(accel_times, accels, jerk_times, jerks);
+
+        for (double accel : accels)
+        {
+            TEST_ASSERT_TRUE_MESSAGE(fabs(accel) <= ACCEL_TOLERANCE * STEPPER_DEFAULT_ACCEL, "acceleration above the set one");
+        }
+        for (double jerk : jerks)
+        {
+            TEST_ASSERT_TRUE_MESSAGE(fabs(jerk) <= JERK_TOLERANCE * STEPPER_DEFAULT_JERK, "acceleration changes faster than the set jerk");
+        }
+    }
+}
+
+void test_move_duration()
+{
+    // moveDuration() and profileScaleForDuration() know the lower peak of the short moves
+    AccelStepper stepper(STEP_PIN, DIR_PIN, STEPS_PER_REVOLUTION);
+    configure(stepper);
+    for (long distance : distances)
+    {
+        float duration = stepper.moveDuration(distance);
+        TEST_ASSERT_FLOAT_WITHIN(0.01, 1.0, stepper.profileScaleForDuration(distance, duration));
+        // the first step is taken at the start of the ramp, where the ideal profile still creeps
+        std::vector<double> times = stepTimes(distance);
+        TEST_ASSERT_FLOAT_WITHIN(0.05 * duration + 0.2, duration, times.back());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    (void)(argc);
+    (void)(argv);
+    UNITY_BEGIN();
+    RUN_TEST(test_speed_continuous);
+    RUN_TEST(test_acceleration_and_jerk_limited);
+    RUN_TEST(test_move_duration);
+    return UNITY_END();
+}
@@ -0,0 +1,199 @@
+#include <Arduino.h>
+#include <AccelStepper.h>
+#include <unity.h>
+#include <Wire.h>
+#include <vector>
+#include "config.h"
+#include "packet_handlers.h"
+#include "steppers.h"
+#include "step_engine.h"
+
+// runs the firmware on the simulated clock of the shim and compares the step times of stepper 0 with a stepper
+// that is polled every microsecond, the timer may only delay a step by up to STEP_TIMER_MIN_DELAY_US
+
+void setup();
+void loop();
+
+#define STEPPER_0_STEP_PIN 26 // x1m
+#define REFERENCE_STEP_PIN 48
+#define REFERENCE_DIR_PIN 49
+
+std::vector<unsigned long> engine_steps;
+
+void recordStep(uint8_t pin, bool level)
+{
+    if (pin == STEPPER_0_STEP_PIN && level)
+        engine_steps.push_back(micros());
+}
+
+// step times of a stepper configured like stepper 0, run to target from start
+std::vector<unsigned long> referenceSteps(long from, long target, unsigned long start)
+{
+    AccelStepper reference(REFERENCE_STEP_PIN, REFERENCE_DIR_PIN, STEPS_PER_REVOLUTION);
+    reference.setMaxSpeed(STEPPER_DEFAULT_SPEED);
+    reference.setAcceleration(STEPPER_DEFAULT_ACCEL);
+    reference.setCurrentPosition(from);
+    reference.moveTo(target);
+
+    std::vector<unsigned long> steps;
+    long position = from;
+    bool running = true;
+    for (unsigned long now = start; running; now++)
+    {
+        running = reference.run(now);
+        if (reference.currentPosition() != position)
+        {
+            position = reference.currentPosition();
+            steps.push_back(now);
+        }
+    }
+    return steps;
+}
+
+// runs loop() every loop_period_us, or sleeping until the next interrupt with 0, until all steppers are at rest
+// with a meanwhile function it is called before each pass, e.g. to send commands
+void runUntilIdle(unsigned long loop_period_us, void (*meanwhile)() = nullptr)
+{
+    unsigned long timeout = micros() + 60000000UL;
+    while (!stepEngineIdle() && (long)(micros() - timeout) < 0)
+    {
+        if (meanwhile)
+            meanwhile();
+        loop();
+        if (loop_period_us)
+            shimAdvanceTo(micros() + loop_period_us);
+    }
+}
+
+void assertStepsFollowReference(long target, unsigned long loop_period_us, void (*meanwhile)() = nullptr)
+{
+    long from = stepper_bank[0].currentPosition();
+    engine_steps.clear();
+
+    stepEngineLock();
+    stepper_bank[0].moveTo(target);
+    stepEngineUnlock();
+    unsigned long start = micros();
+    runUntilIdle(loop_period_us, meanwhile);
+
+    std::vector<unsigned long> expected = referenceSteps(from, target, start);
+    TEST_ASSERT_EQUAL(expected.size(), engine_steps.size());
+    TEST_ASSERT_EQUAL(target, stepper_bank[0].currentPosition());
+    // the first step waits for the next tick, all later ones are timed from it
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        long deviation = (long)((engine_steps[i] - engine_steps[0]) - (expected[i] - expected[0]));
+        TEST_ASSERT_INT_WITHIN(STEP_TIMER_MIN_DELAY_US, 0, deviation);
+    }
+}
+
+// a command with its checksum filled in, sent like a write of the master
+template <typename T>
+void sendCommand(T data)
+{
+    byte *buffer = reinterpret_cast<byte *>(&data);
+    data.checksum = 0;
+    for (uint8_t i = 0; i < sizeof(T) - 1; i++)
+    {
+        data.checksum += buffer[i];
+    }
+    Wire.receive(buffer, sizeof(T));
+}
+
+// keeps the other steppers busy with a new target and acceleration every pass
+void sendCommandsToOtherSteppers()
+{
+    static uint16_t pass = 0;
+    if (pass++ >= 100)
+        return;
+    int8_t stepper_id = 1 + pass % (NUM_STEPPERS - 1);
+    sendCommand(set_accel_datastruct{set_accel, (uint16_t)((pass % 2) ? MAX_ACCEL : STEPPER_DEFAULT_ACCEL), stepper_id, 0});
+    sendCommand(moveTo_datastruct{moveTo, (int16_t)((pass * 97) % STEPS_PER_REVOLUTION), 0, stepper_id, 0});
+}
+
+// stands in for a command that keeps the cpu busy for a while, its stepper is locked but interrupts stay enabled
+void slowCommandOnStepper1()
+{
+    static uint8_t commands = 0;
+    if (commands++ >= 50)
+        return;
+    stepEngineLock(1 << 1);
+    stepper_bank[1].move(20);
+    shimAdvanceTo(micros() + 400);
+    stepEngineUnlock();
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_steps_follow_ramp()
+{
+    assertStepsFollowReference(stepper_bank[0].currentPosition() + 1500, 0);
+}
+
+void test_busy_loop_does_not_delay_steps()
+{
+    // commands that keep the loop busy for milliseconds cant delay the steps generated by the timer
+    assertStepsFollowReference(stepper_bank[0].currentPosition() - 1000, 5000);
+}
+
+void test_commands_keep_other_steppers_on_time()
+{
+    // commands executed while stepper 0 runs only lock the steppers they change
+    assertStepsFollowReference(stepper_bank[0].currentPosition() + 1200, 2000, sendCommandsToOtherSteppers);
+}
+
+void test_slow_command_does_not_delay_other_steppers()
+{
+    assertStepsFollowReference(stepper_bank[0].currentPosition() - 800, 1000, slowCommandOnStepper1);
+    // the locked stepper is picked up again after each command
+    TEST_ASSERT_EQUAL(0, stepper_bank[1].distanceToGo());
+}
+
+void test_timer_interrupts_only_for_steps()
+{
+    // each step takes one interrupt to raise the step pin and one to lower it, none are spent waiting in between
+    // besides the run() that starts the move and the one that finds it finished, neither of which steps
+    unsigned long interrupts_before = HardwareTimer::active->interrupt_count;
+    assertStepsFollowReference(stepper_bank[0].currentPosition() + 500, 0);
+    unsigned long interrupts = HardwareTimer::active->interrupt_count - interrupts_before;
+    TEST_ASSERT_LESS_OR_EQUAL(2 * engine_steps.size() + 2, interrupts);
+}
+
+void test_timer_paused_when_idle()
+{
+    runUntilIdle(0);
+    TEST_ASSERT_TRUE(stepEngineIdle());
+    TEST_ASSERT_FALSE(HardwareTimer::active->running);
+
+    stepEngineLock();
+    stepper_bank[3].move(10);
+    stepEngineUnlock();
+    TEST_ASSERT_TRUE(HardwareTimer::active->running);
+    runUntilIdle(0);
+    TEST_ASSERT_FALSE(HardwareTimer::active->running);
+}
+
+int main(int argc, char **argv)
+{
+    (void)(argc);
+    (void)(argv);
+    shim::on_pin_change = recordStep;
+    setup();
+    // the steppers start with moving to 12 o'clock
+    runUntilIdle(0);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_steps_follow_ramp);
+    RUN_TEST(test_busy_loop_does_not_delay_steps);
+    RUN_TEST(test_commands_keep_other_steppers_on_time);
+    RUN_TEST(test_slow_command_does_not_delay_other_steppers);
+    RUN_TEST(test_timer_interrupts_only_for_steps);
+    RUN_TEST(test_timer_paused_when_idle);
+    return UNITY_END();
+}
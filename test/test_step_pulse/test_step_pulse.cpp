@@ -0,0 +1,180 @@
+#include <Arduino.h>
+#include <AccelStepper.h>
+#include <unity.h>
+#include <limits.h>
+#include "config.h"
+#include "steppers.h"
+#include "step_engine.h"
+
+// follows every level change of the step and dir pins on the simulated clock of the shim and checks the timing the
+// a4988 needs: step pulses at least the min pulse width high and low, and the dir pin set up before the step pulse
+
+void setup();
+void loop();
+
+#define REFERENCE_STEP_PIN 48
+#define REFERENCE_DIR_PIN 49
+#define REFERENCE_MIN_PULSE_WIDTH_US 30
+
+struct PinTiming
+{
+    bool level;
+    unsigned long changed_at;
+};
+
+PinTiming pins[SHIM_NUM_PINS];
+uint8_t dir_pin_of[SHIM_NUM_PINS]; // dir pin of each step pin, 0xFF for other pins
+unsigned long num_pulses;
+unsigned long shortest_high;
+unsigned long shortest_low;
+unsigned long shortest_dir_setup;
+
+void onPinChange(uint8_t pin, bool level)
+{
+    unsigned long now = micros();
+    if (dir_pin_of[pin] != 0xFF)
+    {
+        unsigned long duration = now - pins[pin].changed_at;
+        if (level)
+        {
+            // the first pulse of a pin has no low phase before it to check
+            if (pins[pin].changed_at)
+                shortest_low = min(shortest_low, duration);
+            shortest_dir_setup = min(shortest_dir_setup, now - pins[dir_pin_of[pin]].changed_at);
+            num_pulses++;
+        }
+        else
+            shortest_high = min(shortest_high, duration);
+    }
+    pins[pin].level = level;
+    pins[pin].changed_at = now;
+}
+
+void resetTimings()
+{
+    num_pulses = 0;
+    shortest_high = shortest_low = shortest_dir_setup = ULONG_MAX;
+}
+
+void watchStepper(uint8_t step_pin, uint8_t dir_pin)
+{
+    dir_pin_of[step_pin] = dir_pin;
+    pins[step_pin].changed_at = 0;
+    pins[dir_pin].changed_at = 0;
+}
+
+void runUntilIdle()
+{
+    unsigned long timeout = micros() + 60000000UL;
+    while (!stepEngineIdle() && (long)(micros() - timeout) < 0)
+    {
+        loop();
+    }
+}
+
+void setUp(void)
+{
+    resetTimings();
+}
+
+void tearDown(void)
+{
+}
+
+void test_batched_two_phase_pulses()
+{
+    // back and forth with all steppers, reversing halfway so dir changes between steps of a running stepper
+    stepEngineLock();
+    for (uint8_t i = 0; i < NUM_STEPPERS; i++)
+    {
+        stepper_bank[i].move((i % 2) ? 400 : -300);
+    }
+    stepEngineUnlock();
+    shimAdvanceTo(micros() + 500000);
+    stepEngineLock();
+    for (uint8_t i = 0; i < NUM_STEPPERS; i++)
+    {
+        stepper_bank[i].move((i % 2) ? -200 : 250);
+    }
+    stepEngineUnlock();
+    runUntilIdle();
+
+    TEST_ASSERT_GREATER_THAN(1000, num_pulses);
+    TEST_ASSERT_GREATER_OR_EQUAL(STEP_MIN_PULSE_WIDTH_US, shortest_high);
+    TEST_ASSERT_GREATER_OR_EQUAL(STEP_MIN_PULSE_WIDTH_US, shortest_low);
+    TEST_ASSERT_GREATER_OR_EQUAL(STEP_DIR_SETUP_US, shortest_dir_setup);
+    // the pulses raised by the last tick are lowered before the step engine counts as idle
+    for (uint8_t pin = 0; pin < SHIM_NUM_PINS; pin++)
+    {
+        if (dir_pin_of[pin] != 0xFF)
+            TEST_ASSERT_FALSE(pins[pin].level);
+    }
+}
+
+void test_accelstepper_two_phase_pulses()
+{
+    AccelStepper stepper(REFERENCE_STEP_PIN, REFERENCE_DIR_PIN, STEPS_PER_REVOLUTION);
+    watchStepper(REFERENCE_STEP_PIN, REFERENCE_DIR_PIN);
+    stepper.setTwoPhasePulse(true);
+    stepper.setMinPulseWidth(REFERENCE_MIN_PULSE_WIDTH_US);
+    stepper.setMaxSpeed(MAX_SPEED);
+    stepper.setAcceleration(MAX_ACCEL);
+    stepper.moveTo(300);
+
+    // run() called from a scheduler, which only calls it when nextRunTime() is reached
+    while (stepper.isScheduled())
+    {
+        shimAdvanceTo(stepper.nextRunTime(micros()));
+        stepper.run(micros());
+        if (stepper.distanceToGo() == 0 && stepper.targetPosition() == 300)
+            stepper.moveTo(0);
+    }
+
+    TEST_ASSERT_EQUAL(600, num_pulses);
+    TEST_ASSERT_GREATER_OR_EQUAL(REFERENCE_MIN_PULSE_WIDTH_US, shortest_high);
+    TEST_ASSERT_GREATER_OR_EQUAL(REFERENCE_MIN_PULSE_WIDTH_US, shortest_low);
+    TEST_ASSERT_FALSE(pins[REFERENCE_STEP_PIN].level);
+}
+
+void test_accelstepper_two_phase_pulses_polled()
+{
+    // run() called as often as possible, it must not lower the pin before the pulse width has passed
+    AccelStepper stepper(REFERENCE_STEP_PIN, REFERENCE_DIR_PIN, STEPS_PER_REVOLUTION);
+    watchStepper(REFERENCE_STEP_PIN, REFERENCE_DIR_PIN);
+    stepper.setTwoPhasePulse(true);
+    stepper.setMinPulseWidth(REFERENCE_MIN_PULSE_WIDTH_US);
+    stepper.setMaxSpeed(MAX_SPEED);
+    stepper.setAcceleration(MAX_ACCEL);
+    stepper.move(200);
+
+    while (stepper.isScheduled())
+    {
+        stepper.run(micros());
+        shimAdvanceTo(micros() + 1);
+    }
+
+    TEST_ASSERT_EQUAL(200, num_pulses);
+    TEST_ASSERT_GREATER_OR_EQUAL(REFERENCE_MIN_PULSE_WIDTH_US, shortest_high);
+    TEST_ASSERT_LESS_OR_EQUAL(REFERENCE_MIN_PULSE_WIDTH_US + 1, shortest_high);
+    TEST_ASSERT_FALSE(pins[REFERENCE_STEP_PIN].level);
+}
+
+int main(int argc, char **argv)
+{
+    (void)(argc);
+    (void)(argv);
+    memset(dir_pin_of, 0xFF, sizeof(dir_pin_of));
+    for (uint8_t i = 0; i < NUM_STEPPERS; i++)
+    {
+        watchStepper(stepper_bank[i].pin[0], stepper_bank[i].pin[1]);
+    }
+    shim::on_pin_change = onPinChange;
+    setup();
+    runUntilIdle();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_batched_two_phase_pulses);
+    RUN_TEST(test_accelstepper_two_phase_pulses);
+    RUN_TEST(test_accelstepper_two_phase_pulses_polled);
+    return UNITY_END();
+}